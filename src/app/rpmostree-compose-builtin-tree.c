@@ -31,6 +31,7 @@
 #include <linux/magic.h>
 #include <sys/statvfs.h>
 #include <sys/vfs.h>
+#include <unistd.h>
 #include <libglnx.h>
 #include <rpm/rpmmacro.h>
 
@@ -43,6 +44,7 @@
 #include "rpmostree-passwd-util.h"
 #include "rpmostree-libbuiltin.h"
 #include "rpmostree-rpm-util.h"
+#include "rpmostree-output.h"
 
 #include "libglnx.h"
 
@@ -62,6 +64,7 @@ static char *opt_touch_if_changed;
 static gboolean opt_dry_run;
 static gboolean opt_print_only;
 static char *opt_write_commitid_to;
+static char *opt_write_timings_to;
 
 /* shared by both install & commit */
 static GOptionEntry common_option_entries[] = {
@@ -82,6 +85,7 @@ static GOptionEntry install_option_entries[] = {
   { "touch-if-changed", 0, 0, G_OPTION_ARG_STRING, &opt_touch_if_changed, "Update the modification time on FILE if a new commit was created", "FILE" },
   { "workdir", 0, 0, G_OPTION_ARG_STRING, &opt_workdir, "Working directory", "WORKDIR" },
   { "workdir-tmpfs", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE, &opt_workdir_tmpfs, "Use tmpfs for working state", NULL },
+  { "write-timings-to", 0, 0, G_OPTION_ARG_STRING, &opt_write_timings_to, "Write the duration of each phase as JSON to FILE", "FILE" },
   { NULL }
 };
 
@@ -1040,6 +1044,16 @@ impl_install_tree (RpmOstreeTreeComposeContext *self,
                            rpmostree_context_get_rpmmd_repo_commit_metadata (self->corectx));
     }
 
+  /* The package list is used client-side for easily previewing pending updates;
+   * we know the final package set already, so no need to reload the rpmdb at
+   * commit time.
+   */
+  { GVariant *pkglist = rpmostree_context_get_rpmdb_pkglist (self->corectx);
+    /* If we didn't depsolve, impl_commit_tree() falls back to the rpmdb */
+    if (pkglist)
+      g_hash_table_insert (self->metadata, g_strdup ("rpmostree.rpmdb.pkglist"), pkglist);
+  }
+
   /* Destroy this now so the libdnf stack won't have any references
    * into the filesystem before we manipulate it.
    */
@@ -1105,6 +1119,114 @@ repo_is_on_netfs (OstreeRepo  *repo)
   return stbuf.f_type == NFS_SUPER_MAGIC;
 }
 
+static gboolean
+import_objects_of_type (OstreeRepo       *dest,
+                        OstreeRepo       *src,
+                        OstreeRepo       *pkgcache_repo,
+                        GPtrArray        *objects,
+                        OstreeObjectType  objtype,
+                        GCancellable     *cancellable,
+                        GError          **error)
+{
+  for (guint i = 0; i < objects->len; i++)
+    {
+      const char *checksum;
+      OstreeObjectType type;
+      ostree_object_name_deserialize (objects->pdata[i], &checksum, &type);
+      if (type != objtype)
+        continue;
+
+      /* Content from devino cache hits was never written to @src */
+      g_autoptr(GError) local_error = NULL;
+      if (!ostree_repo_import_object_from (dest, src, objtype, checksum,
+                                           cancellable, &local_error))
+        {
+          if (!pkgcache_repo || objtype != OSTREE_OBJECT_TYPE_FILE ||
+              !g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+            return g_propagate_error (error, g_steal_pointer (&local_error)), FALSE;
+          if (!ostree_repo_import_object_from (dest, pkgcache_repo, objtype, checksum,
+                                               cancellable, error))
+            return FALSE;
+        }
+    }
+  return TRUE;
+}
+
+/* Copy the objects for @rev from the local @src repo into @dest, skipping any
+ * that @dest already has (e.g. from the previous commit). Content which @src
+ * only references through the devino cache is copied from @pkgcache_repo.
+ *
+ * Everything but the commit object is written without fsync, followed by a
+ * single syncfs(); then the commit object goes last, so that @dest never has a
+ * partial commit.
+ */
+static gboolean
+import_new_objects_from_staging (OstreeRepo    *dest,
+                                 OstreeRepo    *src,
+                                 OstreeRepo    *pkgcache_repo,
+                                 const char    *rev,
+                                 guint         *out_n_total,
+                                 guint         *out_n_copied,
+                                 GCancellable  *cancellable,
+                                 GError       **error)
+{
+  g_autoptr(GHashTable) reachable = NULL;
+  if (!ostree_repo_traverse_commit (src, rev, 0, &reachable, cancellable, error))
+    return FALSE;
+
+  /* One listing of @dest is a lot cheaper than a stat per object over NFS */
+  g_autoptr(GHashTable) dest_objects = NULL;
+  if (!ostree_repo_list_objects (dest, OSTREE_REPO_LIST_OBJECTS_ALL, &dest_objects,
+                                 cancellable, error))
+    return FALSE;
+
+  g_autoptr(GPtrArray) new_objects = g_ptr_array_new ();
+  GLNX_HASH_TABLE_FOREACH (reachable, GVariant*, object)
+    {
+      if (!g_hash_table_contains (dest_objects, object))
+        g_ptr_array_add (new_objects, object);
+    }
+
+  const OstreeObjectType import_order[] = { OSTREE_OBJECT_TYPE_FILE,
+                                            OSTREE_OBJECT_TYPE_DIR_META,
+                                            OSTREE_OBJECT_TYPE_DIR_TREE };
+  const gboolean disable_fsync = ostree_repo_get_disable_fsync (dest);
+  ostree_repo_set_disable_fsync (dest, TRUE);
+  gboolean imported = TRUE;
+  for (guint i = 0; imported && i < G_N_ELEMENTS (import_order); i++)
+    imported = import_objects_of_type (dest, src, pkgcache_repo, new_objects,
+                                       import_order[i], cancellable, error);
+  ostree_repo_set_disable_fsync (dest, disable_fsync);
+  if (!imported)
+    return FALSE;
+
+  if (!disable_fsync)
+    {
+      if (syncfs (ostree_repo_get_dfd (dest)) < 0)
+        return glnx_throw_errno_prefix (error, "syncfs");
+    }
+
+  if (!import_objects_of_type (dest, src, NULL, new_objects, OSTREE_OBJECT_TYPE_COMMIT,
+                               cancellable, error))
+    return FALSE;
+
+  /* And the detached metadata, if we signed it */
+  g_autoptr(GVariant) detached_meta = NULL;
+  if (!ostree_repo_read_commit_detached_metadata (src, rev, &detached_meta,
+                                                  cancellable, error))
+    return FALSE;
+  if (detached_meta)
+    {
+      if (!ostree_repo_write_commit_detached_metadata (dest, rev, detached_meta,
+                                                       cancellable, error))
+        return FALSE;
+    }
+
+  *out_n_total = g_hash_table_size (reachable);
+  *out_n_copied = new_objects->len;
+  return TRUE;
+}
+
 /* Perform required postprocessing, and invoke rpmostree_compose_commit(). */
 static gboolean
 impl_commit_tree (RpmOstreeTreeComposeContext *self,
@@ -1125,14 +1247,16 @@ impl_commit_tree (RpmOstreeTreeComposeContext *self,
     GLNX_HASH_TABLE_FOREACH_KV (self->metadata, const char*, strkey, GVariant*, v)
       g_variant_builder_add (metadata_builder, "{sv}", strkey, v);
 
-    /* include list of packages in rpmdb; this is used client-side for easily previewing
-     * pending updates. once we only support unified core composes, this can easily be much
-     * more readily injected during assembly */
-    g_autoptr(GVariant) rpmdb_v = NULL;
-    if (!rpmostree_create_rpmdb_pkglist_variant (self->rootfs_dfd, &rpmdb_v,
-                                                 cancellable, error))
-      return FALSE;
-    g_variant_builder_add (metadata_builder, "{sv}", "rpmostree.rpmdb.pkglist", rpmdb_v);
+    /* include list of packages in rpmdb if we didn't get it from the install
+     * phase, i.e. for `compose commit` */
+    if (!g_hash_table_contains (self->metadata, "rpmostree.rpmdb.pkglist"))
+      {
+        g_autoptr(GVariant) rpmdb_v = NULL;
+        if (!rpmostree_create_rpmdb_pkglist_variant (self->rootfs_dfd, &rpmdb_v,
+                                                     cancellable, error))
+          return FALSE;
+        g_variant_builder_add (metadata_builder, "{sv}", "rpmostree.rpmdb.pkglist", rpmdb_v);
+      }
 
     metadata = g_variant_ref_sink (g_variant_builder_end (metadata_builder));
     /* Canonicalize to big endian, like OSTree does. Without this, any numbers
@@ -1150,7 +1274,11 @@ impl_commit_tree (RpmOstreeTreeComposeContext *self,
 
   if (!rpmostree_rootfs_postprocess_common (self->rootfs_dfd, cancellable, error))
     return FALSE;
+  /* Only cache generated initramfs images if the cachedir persists */
+  const int initramfs_cache_dfd = opt_cachedir ? self->cachedir_dfd : -1;
   if (!rpmostree_postprocess_final (self->rootfs_dfd, self->treefile, opt_ex_unified_core,
+                                    self->previous_root, self->pkgcache_repo,
+                                    initramfs_cache_dfd,
                                     cancellable, error))
     return FALSE;
 
@@ -1168,13 +1296,41 @@ impl_commit_tree (RpmOstreeTreeComposeContext *self,
         glnx_prefix_error (error, "Handling group db");
     }
 
-  /* See comment above */
-  const gboolean use_txn = (getenv ("RPMOSTREE_COMMIT_NO_TXN") == NULL &&
-                            !repo_is_on_netfs (self->repo));
+  g_auto(RpmOstreeOutputPhase) phase = rpmostree_output_phase_begin ("commit");
+
+  const gboolean use_txn = (getenv ("RPMOSTREE_COMMIT_NO_TXN") == NULL);
+
+  /* Transactions don't work on network filesystems (see the issue linked
+   * above repo_is_on_netfs()). Rather than writing every object straight to
+   * the target repo, commit into a staging repo on local disk, and then only
+   * copy over the objects the target is missing. Note we can't use the workdir
+   * here for unified core, since it lives inside the target repo.
+   */
+  g_auto(GLnxTmpDir) staging_tmpdir = { 0, };
+  g_autoptr(OstreeRepo) staging_repo = NULL;
+  if (use_txn && repo_is_on_netfs (self->repo))
+    {
+      const int staging_parent_dfd = opt_ex_unified_core ? AT_FDCWD : self->workdir_dfd;
+      g_autofree char *staging_template = NULL;
+      if (opt_ex_unified_core)
+        staging_template = g_build_filename (g_getenv ("TMPDIR") ?: "/var/tmp",
+                                             "rpm-ostree-staging.XXXXXX", NULL);
+      else
+        staging_template = g_strdup ("staging.XXXXXX");
+      if (!glnx_mkdtempat (staging_parent_dfd, staging_template, 0700,
+                           &staging_tmpdir, error))
+        return FALSE;
+      staging_repo = ostree_repo_create_at (staging_tmpdir.fd, "repo",
+                                            ostree_repo_get_mode (self->repo), NULL,
+                                            cancellable, error);
+      if (!staging_repo)
+        return FALSE;
+    }
+  OstreeRepo *commit_repo = staging_repo ?: self->repo;
 
   if (use_txn)
     {
-      if (!ostree_repo_prepare_transaction (self->repo, NULL, cancellable, error))
+      if (!ostree_repo_prepare_transaction (commit_repo, NULL, cancellable, error))
         return FALSE;
     }
 
@@ -1187,36 +1343,55 @@ impl_commit_tree (RpmOstreeTreeComposeContext *self,
 
   /* The penultimate step, just basically `ostree commit` */
   g_autofree char *new_revision = NULL;
-  if (!rpmostree_compose_commit (self->rootfs_dfd, self->repo, parent_revision,
+  /* Devino cache hits aren't written to a staging repo; we copy those objects
+   * from the pkgcache later instead.
+   */
+  if (!rpmostree_compose_commit (self->rootfs_dfd, commit_repo, parent_revision,
                                  metadata, gpgkey, selinux, self->devino_cache,
                                  &new_revision, cancellable, error))
     return FALSE;
 
   /* --write-commitid-to overrides writing the ref */
-  if (self->ref && !opt_write_commitid_to)
+  const gboolean write_ref = (self->ref && !opt_write_commitid_to);
+  const gboolean ref_in_txn = (use_txn && !staging_repo);
+  if (write_ref && ref_in_txn)
+    ostree_repo_transaction_set_ref (self->repo, NULL, self->ref, new_revision);
+
+  if (use_txn)
     {
-      if (use_txn)
-        ostree_repo_transaction_set_ref (self->repo, NULL, self->ref, new_revision);
-      else
+      OstreeRepoTransactionStats stats = { 0, };
+      if (!ostree_repo_commit_transaction (commit_repo, &stats, cancellable, error))
+        return glnx_prefix_error (error, "Commit");
+
+      if (!staging_repo)
         {
-          if (!ostree_repo_set_ref_immediate (self->repo, NULL, self->ref, new_revision,
-                                              cancellable, error))
-            return FALSE;
+          g_print ("Metadata Total: %u\n", stats.metadata_objects_total);
+          g_print ("Metadata Written: %u\n", stats.metadata_objects_written);
+          g_print ("Content Total: %u\n", stats.content_objects_total);
+          g_print ("Content Written: %u\n", stats.content_objects_written);
+          g_print ("Content Bytes Written: %" G_GUINT64_FORMAT "\n", stats.content_bytes_written);
         }
     }
 
-  if (use_txn)
+  if (staging_repo)
     {
-      OstreeRepoTransactionStats stats = { 0, };
-      if (!ostree_repo_commit_transaction (self->repo, &stats, cancellable, error))
-        return glnx_prefix_error (error, "Commit");
+      guint n_total, n_copied;
+      if (!import_new_objects_from_staging (self->repo, staging_repo, self->pkgcache_repo,
+                                            new_revision, &n_total, &n_copied,
+                                            cancellable, error))
+        return glnx_prefix_error (error, "Copying objects from staging repo");
+
+      g_print ("Objects Total: %u\n", n_total);
+      g_print ("Objects Copied: %u\n", n_copied);
+    }
 
-      g_print ("Metadata Total: %u\n", stats.metadata_objects_total);
-      g_print ("Metadata Written: %u\n", stats.metadata_objects_written);
-      g_print ("Content Total: %u\n", stats.content_objects_total);
-      g_print ("Content Written: %u\n", stats.content_objects_written);
-      g_print ("Content Bytes Written: %" G_GUINT64_FORMAT "\n", stats.content_bytes_written);
+  if (write_ref && !ref_in_txn)
+    {
+      if (!ostree_repo_set_ref_immediate (self->repo, NULL, self->ref, new_revision,
+                                          cancellable, error))
+        return FALSE;
     }
+  rpmostree_output_phase_end (&phase);
   g_print ("Wrote commit: %s\n", new_revision);
 
   if (opt_write_commitid_to)
@@ -1272,6 +1447,9 @@ rpmostree_compose_builtin_install (int             argc,
   const char *destdir = argv[2];
   opt_workdir = g_strdup (destdir);
 
+  if (opt_write_timings_to)
+    rpmostree_output_timings_enable ();
+
   g_autoptr(RpmOstreeTreeComposeContext) self = NULL;
   if (!rpm_ostree_compose_context_new (treefile_path, &self, cancellable, error))
     return FALSE;
@@ -1280,6 +1458,12 @@ rpmostree_compose_builtin_install (int             argc,
     return FALSE;
   g_print ("rootfs: %s/rootfs\n", destdir);
 
+  if (opt_write_timings_to)
+    {
+      if (!rpmostree_output_timings_write (opt_write_timings_to, error))
+        return FALSE;
+    }
+
   return TRUE;
 }
 
@@ -1333,7 +1517,7 @@ rpmostree_compose_builtin_postprocess (int             argc,
   if (!rpmostree_rootfs_postprocess_common (rootfs_dfd, cancellable, error))
     return FALSE;
   if (!rpmostree_postprocess_final (rootfs_dfd, treefile, opt_ex_unified_core,
-                                    cancellable, error))
+                                    NULL, NULL, -1, cancellable, error))
     return FALSE;
   return TRUE;
 }
@@ -1417,6 +1601,9 @@ rpmostree_compose_builtin_tree (int             argc,
 
   const char *treefile_path = argv[1];
 
+  if (opt_write_timings_to)
+    rpmostree_output_timings_enable ();
+
   g_autoptr(RpmOstreeTreeComposeContext) self = NULL;
   if (!rpm_ostree_compose_context_new (treefile_path, &self, cancellable, error))
     return FALSE;
@@ -1433,6 +1620,11 @@ rpmostree_compose_builtin_tree (int             argc,
         return FALSE;
     }
 
+  if (opt_write_timings_to)
+    {
+      if (!rpmostree_output_timings_write (opt_write_timings_to, error))
+        return FALSE;
+    }
 
   return TRUE;
 }
@@ -194,6 +194,285 @@ symlink_at_replace (const char    *oldpath,
   return TRUE;
 }
 
+/* We record which commit each root was checked out from in a hidden file
+ * next to it, so that upgrades can update the inactive root incrementally.
+ */
+static char *
+get_root_commit_path (const char *rootdir)
+{
+  return g_strconcat (".", rootdir, ".commit", NULL);
+}
+
+static gboolean
+read_root_commit (ROContainerContext *rocctx,
+                  const char         *rootdir,
+                  char              **out_commit,
+                  GCancellable       *cancellable,
+                  GError            **error)
+{
+  g_autofree char *commit_path = get_root_commit_path (rootdir);
+  *out_commit = NULL;
+
+  if (!glnx_fstatat_allow_noent (rocctx->roots_dfd, rootdir, NULL, AT_SYMLINK_NOFOLLOW, error))
+    return FALSE;
+  if (errno == ENOENT)
+    return TRUE; /* Note early return */
+
+  if (!glnx_fstatat_allow_noent (rocctx->roots_dfd, commit_path, NULL, AT_SYMLINK_NOFOLLOW, error))
+    return FALSE;
+  if (errno == ENOENT)
+    return TRUE; /* Note early return */
+
+  g_autofree char *commit = glnx_file_get_contents_utf8_at (rocctx->roots_dfd, commit_path,
+                                                            NULL, cancellable, error);
+  if (!commit)
+    return FALSE;
+  g_strchomp (commit);
+  if (!ostree_validate_checksum_string (commit, NULL))
+    return TRUE; /* Treat garbage as unknown */
+
+  gboolean has_commit;
+  if (!ostree_repo_has_object (rocctx->repo, OSTREE_OBJECT_TYPE_COMMIT, commit,
+                               &has_commit, cancellable, error))
+    return FALSE;
+  if (has_commit)
+    *out_commit = g_steal_pointer (&commit);
+  return TRUE;
+}
+
+/* Replace @f (a file in @commit) at the same path under @root_dfd */
+static gboolean
+checkout_one_path (OstreeRepo   *repo,
+                   int           root_dfd,
+                   GFile        *f,
+                   const char   *commit,
+                   gboolean     *out_is_dir,
+                   GCancellable *cancellable,
+                   GError      **error)
+{
+  const char *path = gs_file_get_path_cached (f);
+  const char *relpath = path + strspn (path, "/");
+  const char *bname = glnx_basename (relpath);
+
+  g_autoptr(GFileInfo) finfo = g_file_query_info (f, "standard::type",
+                                                  G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                                  cancellable, error);
+  if (!finfo)
+    return FALSE;
+  const gboolean is_dir = g_file_info_get_file_type (finfo) == G_FILE_TYPE_DIRECTORY;
+
+  glnx_autofd int parent_dfd = -1;
+  g_autofree char *dn = g_path_get_dirname (relpath);
+  if (!glnx_opendirat (root_dfd, dn, TRUE, &parent_dfd, error))
+    return FALSE;
+  if (!glnx_shutil_rm_rf_at (parent_dfd, bname, cancellable, error))
+    return FALSE;
+
+  /* See the comment in ostree-repo-checkout.c:checkout_tree_at(); for
+   * non-directories we check out into the parent directly.
+   */
+  OstreeRepoCheckoutAtOptions opts = { OSTREE_REPO_CHECKOUT_MODE_USER,
+                                       OSTREE_REPO_CHECKOUT_OVERWRITE_UNION_FILES, };
+  opts.subpath = path;
+  if (!ostree_repo_checkout_at (repo, &opts, parent_dfd, is_dir ? bname : ".",
+                                commit, cancellable, error))
+    return g_prefix_error (error, "Checking out %s: ", path), FALSE;
+
+  *out_is_dir = is_dir;
+  return TRUE;
+}
+
+/* ostree_diff_dirs() only looks at directory contents, so it misses
+ * directories whose metadata alone changed. Walk the directories present in
+ * both @from and @to, skipping subtrees whose dirtree and dirmeta are both
+ * unchanged, and re-apply the mode where the dirmeta differs. We check out in
+ * user mode, so ownership and xattrs aren't applied in the first place.
+ */
+static gboolean
+update_dirmeta_recurse (int           root_dfd,
+                        GFile        *from,
+                        GFile        *to,
+                        guint        *inout_n_updated,
+                        GCancellable *cancellable,
+                        GError      **error)
+{
+  OstreeRepoFile *from_dir = (OstreeRepoFile*)from;
+  OstreeRepoFile *to_dir = (OstreeRepoFile*)to;
+  if (!ostree_repo_file_ensure_resolved (from_dir, error))
+    return FALSE;
+  if (!ostree_repo_file_ensure_resolved (to_dir, error))
+    return FALSE;
+
+  if (!g_str_equal (ostree_repo_file_tree_get_metadata_checksum (from_dir),
+                    ostree_repo_file_tree_get_metadata_checksum (to_dir)))
+    {
+      const char *path = gs_file_get_path_cached (to);
+      const char *relpath = path + strspn (path, "/");
+      guint32 mode;
+      g_variant_get_child (ostree_repo_file_tree_get_metadata (to_dir), 2, "u", &mode);
+      mode = GUINT32_FROM_BE (mode);
+      if (fchmodat (root_dfd, *relpath ? relpath : ".", mode & 07777, 0) < 0)
+        return glnx_throw_errno_prefix (error, "fchmodat(%s)", path);
+      (*inout_n_updated)++;
+    }
+
+  /* The dirtree covers the dirmeta of all subdirectories */
+  if (g_str_equal (ostree_repo_file_tree_get_contents_checksum (from_dir),
+                   ostree_repo_file_tree_get_contents_checksum (to_dir)))
+    return TRUE;
+
+  g_autoptr(GVariant) subdirs =
+    g_variant_get_child_value (ostree_repo_file_tree_get_contents (to_dir), 1);
+  const guint n = g_variant_n_children (subdirs);
+  for (guint i = 0; i < n; i++)
+    {
+      const char *name;
+      g_variant_get_child (subdirs, i, "(&s@ay@ay)", &name, NULL, NULL);
+      g_autoptr(GFile) from_child = g_file_get_child (from, name);
+      /* Added or replaced entries were freshly checked out */
+      if (g_file_query_file_type (from_child, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                  cancellable) != G_FILE_TYPE_DIRECTORY)
+        continue;
+      g_autoptr(GFile) to_child = g_file_get_child (to, name);
+      if (!update_dirmeta_recurse (root_dfd, from_child, to_child, inout_n_updated,
+                                   cancellable, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Update @rootdir, currently a checkout of @from_commit, to be a checkout of
+ * @to_commit by only touching the paths that changed between the two.
+ */
+static gboolean
+checkout_root_incremental (ROContainerContext *rocctx,
+                           const char         *rootdir,
+                           const char         *from_commit,
+                           const char         *to_commit,
+                           GCancellable       *cancellable,
+                           GError            **error)
+{
+  glnx_unref_object GFile *from_tree = NULL;
+  if (!ostree_repo_read_commit (rocctx->repo, from_commit, &from_tree, NULL,
+                                cancellable, error))
+    return FALSE;
+  glnx_unref_object GFile *to_tree = NULL;
+  if (!ostree_repo_read_commit (rocctx->repo, to_commit, &to_tree, NULL,
+                                cancellable, error))
+    return FALSE;
+
+  /* Since dirtree objects are content-addressed, this doesn't descend into
+   * unchanged subtrees at all.
+   */
+  g_autoptr(GPtrArray) modified = g_ptr_array_new_with_free_func ((GDestroyNotify) ostree_diff_item_unref);
+  g_autoptr(GPtrArray) removed = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+  g_autoptr(GPtrArray) added = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+  if (!ostree_diff_dirs (0, from_tree, to_tree, modified, removed, added,
+                         cancellable, error))
+    return FALSE;
+
+  glnx_autofd int root_dfd = -1;
+  if (!glnx_opendirat (rocctx->roots_dfd, rootdir, TRUE, &root_dfd, error))
+    return FALSE;
+
+  for (guint i = 0; i < removed->len; i++)
+    {
+      const char *path = gs_file_get_path_cached (removed->pdata[i]);
+      if (!glnx_shutil_rm_rf_at (root_dfd, path + strspn (path, "/"), cancellable, error))
+        return FALSE;
+    }
+
+  for (guint i = 0; i < modified->len; i++)
+    {
+      OstreeDiffItem *diffitem = modified->pdata[i];
+      gboolean is_dir;
+      if (!checkout_one_path (rocctx->repo, root_dfd, diffitem->target, to_commit,
+                              &is_dir, cancellable, error))
+        return FALSE;
+    }
+
+  /* Like copy_new_config_files() in the livefs code, skip children of added
+   * subdirectories, since the checkout of the directory is recursive.
+   */
+  g_autoptr(GPtrArray) added_subdirs = g_ptr_array_new_with_free_func (g_free);
+  for (guint i = 0; i < added->len; i++)
+    {
+      GFile *added_f = added->pdata[i];
+      const char *path = gs_file_get_path_cached (added_f);
+      if (rpmostree_str_has_prefix_in_ptrarray (path, added_subdirs))
+        continue;
+      gboolean is_dir;
+      if (!checkout_one_path (rocctx->repo, root_dfd, added_f, to_commit,
+                              &is_dir, cancellable, error))
+        return FALSE;
+      if (is_dir)
+        g_ptr_array_add (added_subdirs, g_strconcat (path, "/", NULL));
+    }
+
+  guint n_dirmeta = 0;
+  if (!update_dirmeta_recurse (root_dfd, from_tree, to_tree, &n_dirmeta,
+                               cancellable, error))
+    return FALSE;
+
+  g_print ("Updated %u modified, %u removed, %u added paths, %u directory modes\n",
+           modified->len, removed->len, added->len, n_dirmeta);
+  return TRUE;
+}
+
+/* Check out @commit into @rootdir.  If @rootdir is a previous checkout we know
+ * the commit for, only the differences are applied; otherwise we do a fresh
+ * checkout.
+ */
+static gboolean
+checkout_root (ROContainerContext *rocctx,
+               const char         *rootdir,
+               const char         *commit,
+               GCancellable       *cancellable,
+               GError            **error)
+{
+  g_autofree char *commit_path = get_root_commit_path (rootdir);
+  g_autofree char *previous_commit = NULL;
+  if (!read_root_commit (rocctx, rootdir, &previous_commit, cancellable, error))
+    return FALSE;
+
+  /* Invalidate the record first, so an interrupted update forces a full
+   * checkout next time.
+   */
+  if (!glnx_shutil_rm_rf_at (rocctx->roots_dfd, commit_path, cancellable, error))
+    return FALSE;
+
+  if (previous_commit)
+    {
+      if (!checkout_root_incremental (rocctx, rootdir, previous_commit, commit,
+                                      cancellable, error))
+        return FALSE;
+    }
+  else
+    {
+      OstreeRepoCheckoutAtOptions opts = { OSTREE_REPO_CHECKOUT_MODE_USER,
+                                           OSTREE_REPO_CHECKOUT_OVERWRITE_UNION_FILES, };
+
+      /* Also, what we really want here is some sort of sane lifecycle
+       * management with whatever is running in the root.
+       */
+      if (!glnx_shutil_rm_rf_at (rocctx->roots_dfd, rootdir, cancellable, error))
+        return FALSE;
+
+      if (!ostree_repo_checkout_at (rocctx->repo, &opts, rocctx->roots_dfd, rootdir,
+                                    commit, cancellable, error))
+        return FALSE;
+    }
+
+  if (!glnx_file_replace_contents_at (rocctx->roots_dfd, commit_path,
+                                      (guint8*)commit, strlen (commit),
+                                      GLNX_FILE_REPLACE_NODATASYNC,
+                                      cancellable, error))
+    return FALSE;
+
+  return TRUE;
+}
+
 /* Download and import rpms, then generate a rootfs, and commit it */
 static gboolean
 download_rpms_and_assemble_commit (ROContainerContext *rocctx,
@@ -300,19 +579,8 @@ rpmostree_container_builtin_assemble (int             argc,
     return FALSE;
   g_print ("Checking out %s @ %s...\n", name, commit);
 
-  { OstreeRepoCheckoutAtOptions opts = { OSTREE_REPO_CHECKOUT_MODE_USER,
-                                         OSTREE_REPO_CHECKOUT_OVERWRITE_UNION_FILES, };
-
-    /* Also, what we really want here is some sort of sane lifecycle
-     * management with whatever is running in the root.
-     */
-    if (!glnx_shutil_rm_rf_at (rocctx->roots_dfd, target_rootdir, cancellable, error))
-      return FALSE;
-
-    if (!ostree_repo_checkout_at (rocctx->repo, &opts, rocctx->roots_dfd, target_rootdir,
-                                  commit, cancellable, error))
-      return FALSE;
-  }
+  if (!checkout_root (rocctx, target_rootdir, commit, cancellable, error))
+    return FALSE;
 
   g_print ("Checking out %s @ %s...done\n", name, commit);
 
@@ -470,13 +738,11 @@ rpmostree_container_builtin_upgrade (int argc, char **argv,
 
   g_print ("Checking out %s @ %s...\n", name, new_commit_checksum);
 
-  { OstreeRepoCheckoutAtOptions opts = { OSTREE_REPO_CHECKOUT_MODE_USER,
-                                         OSTREE_REPO_CHECKOUT_OVERWRITE_UNION_FILES, };
-
-    if (!ostree_repo_checkout_at (rocctx->repo, &opts, rocctx->roots_dfd, target_new_root,
-                                  new_commit_checksum, cancellable, error))
-      return FALSE;
-  }
+  /* The inactive root is usually the checkout from two upgrades ago; update it
+   * in place rather than checking out the whole tree again.
+   */
+  if (!checkout_root (rocctx, target_new_root, new_commit_checksum, cancellable, error))
+    return FALSE;
 
   g_print ("Checking out %s @ %s...done\n", name, new_commit_checksum);
 
@@ -82,10 +82,31 @@ rpmostree_db_builtin_diff (int argc, char **argv,
   /* we still use the old API for changelogs; should enhance libdnf for this */
   if (g_str_equal (opt_format, "block") && opt_changelogs)
     {
-      g_autoptr(RpmRevisionData) rpmrev1 = rpmrev_new (repo, old_ref, NULL, cancellable, error);
+      /* Find what changed from the pkglists first, so we only need to load the
+       * headers of those packages rather than the whole rpmdb of both commits.
+       */
+      if (!rpm_ostree_db_diff (repo, old_checksum, new_checksum, &removed, &added,
+                               &modified_old, &modified_new, cancellable, error))
+        return FALSE;
+
+      g_autoptr(GHashTable) changed_names = g_hash_table_new (g_str_hash, g_str_equal);
+      GPtrArray *changed[] = { removed, added, modified_old };
+      for (guint i = 0; i < G_N_ELEMENTS (changed); i++)
+        {
+          for (guint j = 0; j < changed[i]->len; j++)
+            g_hash_table_add (changed_names,
+                              (char*)rpm_ostree_package_get_name (changed[i]->pdata[j]));
+        }
+      g_autoptr(GPtrArray) names = g_ptr_array_new ();
+      GLNX_HASH_TABLE_FOREACH (changed_names, const char*, name)
+        g_ptr_array_add (names, (char*)name);
+
+      g_autoptr(RpmRevisionData) rpmrev1 =
+        rpmrev_new_for_names (repo, old_checksum, names, cancellable, error);
       if (!rpmrev1)
         return EXIT_FAILURE;
-      g_autoptr(RpmRevisionData) rpmrev2 = rpmrev_new (repo, new_ref, NULL, cancellable, error);
+      g_autoptr(RpmRevisionData) rpmrev2 =
+        rpmrev_new_for_names (repo, new_checksum, names, cancellable, error);
       if (!rpmrev2)
         return EXIT_FAILURE;
 
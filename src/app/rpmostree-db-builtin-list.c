@@ -62,17 +62,38 @@ _builtin_db_list (OstreeRepo *repo,
           continue;
         }
 
-      rpmrev = rpmrev_new (repo, rev, patterns,
-                           cancellable, error);
-      if (!rpmrev)
+      g_autofree char *commit = NULL;
+      if (!ostree_repo_resolve_rev (repo, rev, FALSE, &commit, error))
         return FALSE;
 
-      if (!g_str_equal (rev, rpmrev_get_commit (rpmrev)))
-        printf ("ostree commit: %s (%s)\n", rev, rpmrev_get_commit (rpmrev));
+      /* The pkglist has all the NEVRA fields we match on and print, so only
+       * check out the rpmdb for commits which predate it.
+       */
+      g_autoptr(GVariant) commit_v = NULL;
+      if (!ostree_repo_load_commit (repo, commit, &commit_v, NULL, error))
+        return FALSE;
+      g_autoptr(GVariant) metadata = g_variant_get_child_value (commit_v, 0);
+      g_autoptr(GVariant) pkglist =
+        g_variant_lookup_value (metadata, "rpmostree.rpmdb.pkglist",
+                                G_VARIANT_TYPE ("a(stsss)"));
+
+      if (!pkglist)
+        {
+          rpmrev = rpmrev_new (repo, commit, patterns,
+                               cancellable, error);
+          if (!rpmrev)
+            return FALSE;
+        }
+
+      if (!g_str_equal (rev, commit))
+        printf ("ostree commit: %s (%s)\n", rev, commit);
       else
         printf ("ostree commit: %s\n", rev);
 
-      rpmhdrs_list (rpmrev_get_headers (rpmrev));
+      if (pkglist)
+        rpmostree_pkglist_list (pkglist, patterns);
+      else
+        rpmhdrs_list (rpmrev_get_headers (rpmrev));
     }
 
   return TRUE;
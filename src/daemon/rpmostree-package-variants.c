@@ -22,6 +22,7 @@
 
 #include <rpmostree.h>
 #include "rpmostree-package-variants.h"
+#include "rpmostree-core.h"
 #include <libglnx.h>
 
 /**
@@ -112,6 +113,194 @@ rpm_ostree_db_diff_variant_compare_by_type (const void *v1,
   return type1 - type2;
 }
 
+/* Computing a diff means loading the rpmdb of both commits, and clients like to
+ * poll GetCachedUpdateRpmDiff & co. Since the result only depends on the two
+ * commits, keep the most recently used ones in memory. We also stash them
+ * (best effort) on disk, since the daemon exits when idle.
+ */
+#define DIFF_CACHE_MAX_ENTRIES 16
+/* Bump this whenever the serialized format of a diff changes */
+#define DIFF_CACHE_VERSION "1"
+#define DIFF_CACHE_DIR RPMOSTREE_CORE_CACHEDIR "rpmdb-diff-v" DIFF_CACHE_VERSION
+#define DIFF_CACHE_MAX_FILES 64
+
+static GMutex diff_cache_lock;
+static GHashTable *diff_cache; /* "from-to" --> a(sua{sv}) */
+static GQueue diff_cache_lru = G_QUEUE_INIT; /* keys owned by the hash, MRU first */
+
+/* Returns a new ref, or NULL if @key isn't cached */
+static GVariant *
+diff_cache_lookup (const char *key)
+{
+  g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&diff_cache_lock);
+
+  if (!diff_cache)
+    return NULL;
+
+  gpointer orig_key;
+  gpointer value;
+  if (!g_hash_table_lookup_extended (diff_cache, key, &orig_key, &value))
+    return NULL;
+
+  GList *link = g_queue_find (&diff_cache_lru, orig_key);
+  g_assert (link);
+  g_queue_unlink (&diff_cache_lru, link);
+  g_queue_push_head_link (&diff_cache_lru, link);
+
+  return g_variant_ref (value);
+}
+
+static void
+diff_cache_insert (const char *key,
+                   GVariant   *variant)
+{
+  g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&diff_cache_lock);
+
+  if (!diff_cache)
+    diff_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                        (GDestroyNotify)g_variant_unref);
+
+  /* we raced with another caller; the result is the same either way */
+  if (g_hash_table_contains (diff_cache, key))
+    return;
+
+  char *owned_key = g_strdup (key);
+  g_hash_table_insert (diff_cache, owned_key, g_variant_ref (variant));
+  g_queue_push_head (&diff_cache_lru, owned_key);
+
+  while (g_queue_get_length (&diff_cache_lru) > DIFF_CACHE_MAX_ENTRIES)
+    {
+      char *lru_key = g_queue_pop_tail (&diff_cache_lru);
+      g_hash_table_remove (diff_cache, lru_key);
+    }
+}
+
+/* Returns a new ref, or NULL if @key isn't cached or the cache is unreadable */
+static GVariant *
+diff_disk_cache_lookup (const char *key)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autofree char *path = g_strconcat (DIFF_CACHE_DIR "/", key, NULL);
+  glnx_autofd int fd = -1;
+  if (!glnx_openat_rdonly (AT_FDCWD, path, TRUE, &fd, &local_error))
+    {
+      if (!g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        g_debug ("Failed to read cached rpm diff: %s", local_error->message);
+      return NULL;
+    }
+
+  g_autoptr(GBytes) bytes = glnx_fd_readall_bytes (fd, NULL, &local_error);
+  if (!bytes)
+    {
+      g_debug ("Failed to read cached rpm diff: %s", local_error->message);
+      return NULL;
+    }
+
+  g_autoptr(GVariant) variant =
+    g_variant_new_from_bytes (G_VARIANT_TYPE ("a(sua{sv})"), bytes, FALSE);
+  /* bump the mtime so pruning is LRU */
+  (void) futimens (fd, NULL);
+  return g_variant_ref_sink (g_steal_pointer (&variant));
+}
+
+typedef struct {
+  char *name;
+  struct timespec mtime;
+} CachedDiffFile;
+
+static void
+cached_diff_file_clear (gpointer data)
+{
+  CachedDiffFile *f = data;
+  g_free (f->name);
+}
+
+static int
+cached_diff_file_cmp_mtime (gconstpointer a,
+                            gconstpointer b)
+{
+  const CachedDiffFile *fa = a;
+  const CachedDiffFile *fb = b;
+  if (fa->mtime.tv_sec != fb->mtime.tv_sec)
+    return fa->mtime.tv_sec < fb->mtime.tv_sec ? 1 : -1;
+  if (fa->mtime.tv_nsec != fb->mtime.tv_nsec)
+    return fa->mtime.tv_nsec < fb->mtime.tv_nsec ? 1 : -1;
+  return 0;
+}
+
+/* Keep only the DIFF_CACHE_MAX_FILES most recently used entries */
+static gboolean
+prune_diff_disk_cache (int       dfd,
+                       GError  **error)
+{
+  g_autoptr(GArray) entries = g_array_new (FALSE, FALSE, sizeof (CachedDiffFile));
+  g_array_set_clear_func (entries, cached_diff_file_clear);
+
+  g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+  if (!glnx_dirfd_iterator_init_at (dfd, ".", FALSE, &dfd_iter, error))
+    return FALSE;
+  while (TRUE)
+    {
+      struct dirent *dent = NULL;
+      if (!glnx_dirfd_iterator_next_dent_ensure_dtype (&dfd_iter, &dent, NULL, error))
+        return FALSE;
+      if (!dent)
+        break;
+      if (dent->d_type != DT_REG)
+        continue;
+
+      struct stat stbuf;
+      if (!glnx_fstatat (dfd_iter.fd, dent->d_name, &stbuf, AT_SYMLINK_NOFOLLOW, error))
+        return FALSE;
+      CachedDiffFile f = { g_strdup (dent->d_name), stbuf.st_mtim };
+      g_array_append_val (entries, f);
+    }
+
+  if (entries->len <= DIFF_CACHE_MAX_FILES)
+    return TRUE;
+
+  g_array_sort (entries, cached_diff_file_cmp_mtime);
+  for (guint i = DIFF_CACHE_MAX_FILES; i < entries->len; i++)
+    {
+      CachedDiffFile *f = &g_array_index (entries, CachedDiffFile, i);
+      if (!glnx_unlinkat (dfd, f->name, 0, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+diff_disk_cache_store (const char *key,
+                       GVariant   *variant,
+                       GError    **error)
+{
+  if (!glnx_shutil_mkdir_p_at (AT_FDCWD, DIFF_CACHE_DIR, 0755, NULL, error))
+    return FALSE;
+
+  glnx_autofd int dfd = -1;
+  if (!glnx_opendirat (AT_FDCWD, DIFF_CACHE_DIR, TRUE, &dfd, error))
+    return FALSE;
+
+  if (!glnx_file_replace_contents_at (dfd, key,
+                                      g_variant_get_data (variant),
+                                      g_variant_get_size (variant),
+                                      GLNX_FILE_REPLACE_NODATASYNC,
+                                      NULL, error))
+    return FALSE;
+
+  return prune_diff_disk_cache (dfd, error);
+}
+
+static gboolean
+db_diff_variant_uncached (OstreeRepo *repo,
+                          const char *from_rev,
+                          const char *to_rev,
+                          gboolean    allow_noent,
+                          GVariant  **out_variant,
+                          GCancellable *cancellable,
+                          GError **error);
+
 /**
  * rpm_ostree_db_build_diff_variant
  * @repo: A OstreeRepo
@@ -132,6 +321,56 @@ rpm_ostree_db_diff_variant (OstreeRepo *repo,
                             GVariant  **out_variant,
                             GCancellable *cancellable,
                             GError **error)
+{
+  /* callers may pass refs, so key off the commits they point to */
+  g_autofree char *from_checksum = NULL;
+  if (!ostree_repo_resolve_rev (repo, from_rev, FALSE, &from_checksum, error))
+    return FALSE;
+  g_autofree char *to_checksum = NULL;
+  if (!ostree_repo_resolve_rev (repo, to_rev, FALSE, &to_checksum, error))
+    return FALSE;
+
+  g_autofree char *key = g_strconcat (from_checksum, "-", to_checksum, NULL);
+  GVariant *cached = diff_cache_lookup (key);
+  if (!cached)
+    {
+      cached = diff_disk_cache_lookup (key);
+      if (cached)
+        diff_cache_insert (key, cached);
+    }
+  if (cached)
+    {
+      *out_variant = cached;
+      return TRUE; /* Note early return */
+    }
+
+  g_autoptr(GVariant) variant = NULL;
+  if (!db_diff_variant_uncached (repo, from_checksum, to_checksum, allow_noent,
+                                 &variant, cancellable, error))
+    return FALSE;
+
+  /* don't cache misses; the commit may be pulled later on */
+  if (variant)
+    {
+      diff_cache_insert (key, variant);
+
+      g_autoptr(GError) local_error = NULL;
+      if (!diff_disk_cache_store (key, variant, &local_error))
+        g_debug ("Failed to cache rpm diff: %s", local_error->message);
+    }
+
+  *out_variant = g_steal_pointer (&variant);
+  return TRUE;
+}
+
+static gboolean
+db_diff_variant_uncached (OstreeRepo *repo,
+                          const char *from_rev,
+                          const char *to_rev,
+                          gboolean    allow_noent,
+                          GVariant  **out_variant,
+                          GCancellable *cancellable,
+                          GError **error)
 {
   RpmOstreeDbDiffExtFlags flags = 0;
   if (allow_noent)
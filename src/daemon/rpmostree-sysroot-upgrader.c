@@ -917,9 +917,19 @@ perform_local_assembly (RpmOstreeSysrootUpgrader *self,
                      &kernel_path, &initramfs_path);
       g_assert (initramfs_path);
 
+      /* Reuse a previously generated initramfs when the inputs (including all
+       * of the host /etc) match.
+       */
+      if (!glnx_shutil_mkdir_p_at (AT_FDCWD, RPMOSTREE_CORE_CACHEDIR, 0755,
+                                   cancellable, error))
+        return FALSE;
+      glnx_autofd int cache_dfd = -1;
+      if (!glnx_opendirat (AT_FDCWD, RPMOSTREE_CORE_CACHEDIR, TRUE, &cache_dfd, error))
+        return FALSE;
+
       g_auto(GLnxTmpfile) initramfs_tmpf = { 0, };
       if (!rpmostree_run_dracut (self->tmprootfs_dfd, add_dracut_argv, kver,
-                                 initramfs_path, NULL, &initramfs_tmpf,
+                                 initramfs_path, NULL, cache_dfd, &initramfs_tmpf,
                                  cancellable, error))
         return FALSE;
 
@@ -1107,6 +1117,7 @@ rpmostree_sysroot_upgrader_deploy (RpmOstreeSysrootUpgrader *self,
   const char *target_revision = self->final_revision ?: self->base_revision;
   g_assert (target_revision);
 
+  g_auto(RpmOstreeOutputPhase) phase = rpmostree_output_phase_begin ("deploy");
   g_autoptr(GKeyFile) origin = rpmostree_origin_dup_keyfile (self->origin);
   g_autoptr(OstreeDeployment) new_deployment = NULL;
   if (!ostree_sysroot_deploy_tree (self->sysroot, self->osname,
@@ -104,10 +104,14 @@ rpmostreed_deployment_get_for_index (OstreeSysroot *sysroot,
   return g_object_ref (deployments->pdata[deployment_index]);
 }
 
+/* If @gpg_cache is provided, it's used to memoize verification results, keyed
+ * by remote and checksum.
+ */
 static gboolean
 rpmostreed_deployment_gpg_results (OstreeRepo  *repo,
                                    const gchar *origin_refspec,
                                    const gchar *checksum,
+                                   GHashTable  *gpg_cache,
                                    GVariant   **out_results,
                                    gboolean    *out_enabled,
                                    GError     **error)
@@ -133,27 +137,39 @@ rpmostreed_deployment_gpg_results (OstreeRepo  *repo,
       return TRUE;
     }
 
+  g_autofree char *cache_key = g_strconcat (remote, ":", checksum, NULL);
+  GVariant *cached = gpg_cache ? g_hash_table_lookup (gpg_cache, cache_key) : NULL;
+  if (cached)
+    {
+      g_variant_get (cached, "m@av", out_results);
+      *out_enabled = TRUE;
+      return TRUE; /* Note early return */
+    }
+
+  g_autoptr(GVariant) results = NULL;
   g_autoptr(GError) local_error = NULL;
   g_autoptr(OstreeGpgVerifyResult) verify_result =
     ostree_repo_verify_commit_for_remote (repo, checksum, remote, NULL, &local_error);
-  if (!verify_result)
+  /* Somehow, we could have a deployment which has gpg-verify=true, but *doesn't* have a
+   * valid signature. Let's not just bomb out here. We need to return this in the variant so
+   * that `status` can show the appropriate msg. */
+  if (verify_result)
     {
-      /* Somehow, we have a deployment which has gpg-verify=true, but *doesn't* have a valid
-       * signature. Let's not just bomb out here. We need to return this in the variant so
-       * that `status` can show the appropriate msg. */
-      *out_enabled = TRUE;
-      *out_results = NULL;
-      return TRUE;
-    }
+      g_auto(GVariantBuilder) builder;
+      g_variant_builder_init (&builder, G_VARIANT_TYPE ("av"));
 
-  g_auto(GVariantBuilder) builder;
-  g_variant_builder_init (&builder, G_VARIANT_TYPE ("av"));
+      guint n_sigs = ostree_gpg_verify_result_count_all (verify_result);
+      for (guint i = 0; i < n_sigs; i++)
+        g_variant_builder_add (&builder, "v", ostree_gpg_verify_result_get_all (verify_result, i));
 
-  guint n_sigs = ostree_gpg_verify_result_count_all (verify_result);
-  for (guint i = 0; i < n_sigs; i++)
-    g_variant_builder_add (&builder, "v", ostree_gpg_verify_result_get_all (verify_result, i));
+      results = g_variant_ref_sink (g_variant_builder_end (&builder));
+    }
+
+  if (gpg_cache)
+    g_hash_table_insert (gpg_cache, g_steal_pointer (&cache_key),
+                         g_variant_ref_sink (g_variant_new_maybe (G_VARIANT_TYPE ("av"), results)));
 
-  *out_results = g_variant_ref_sink (g_variant_builder_end (&builder));
+  *out_results = g_steal_pointer (&results);
   *out_enabled = TRUE;
   return TRUE;
 }
@@ -221,6 +237,7 @@ rpmostreed_deployment_generate_variant (OstreeSysroot *sysroot,
                                         OstreeDeployment *deployment,
                                         const char *booted_id,
                                         OstreeRepo *repo,
+                                        GHashTable *gpg_cache,
                                         GError **error)
 {
   const gchar *osname = ostree_deployment_get_osname (deployment);
@@ -293,7 +310,8 @@ rpmostreed_deployment_generate_variant (OstreeSysroot *sysroot,
 
   gboolean gpg_enabled = FALSE;
   g_autoptr(GVariant) sigs = NULL;
-  if (!rpmostreed_deployment_gpg_results (repo, refspec, base_checksum, &sigs, &gpg_enabled, error))
+  if (!rpmostreed_deployment_gpg_results (repo, refspec, base_checksum, gpg_cache,
+                                          &sigs, &gpg_enabled, error))
     return NULL;
   variant_add_commit_details (&dict, NULL, commit);
 
@@ -369,6 +387,7 @@ add_all_commit_details_to_vardict (OstreeDeployment *deployment,
                                    const char       *refspec,  /* allow-none */
                                    const char       *checksum, /* allow-none */
                                    GVariant         *commit,   /* allow-none */
+                                   GHashTable       *gpg_cache, /* allow-none */
                                    GVariantDict     *dict,     /* allow-none */
                                    GError          **error)
 {
@@ -408,7 +427,7 @@ add_all_commit_details_to_vardict (OstreeDeployment *deployment,
 
   gboolean gpg_enabled;
   g_autoptr(GVariant) sigs = NULL;
-  if (!rpmostreed_deployment_gpg_results (repo, refspec, checksum,
+  if (!rpmostreed_deployment_gpg_results (repo, refspec, checksum, gpg_cache,
                                           &sigs, &gpg_enabled, error))
     return FALSE;
 
@@ -427,12 +446,13 @@ GVariant *
 rpmostreed_commit_generate_cached_details_variant (OstreeDeployment *deployment,
                                                    OstreeRepo *repo,
                                                    const gchar *refspec,
+                                                   GHashTable *gpg_cache,
                                                    GError **error)
 {
   GVariantDict dict;
   g_variant_dict_init (&dict, NULL);
   if (!add_all_commit_details_to_vardict (deployment, repo, refspec,
-                                          NULL, NULL, &dict, error))
+                                          NULL, NULL, gpg_cache, &dict, error))
     return NULL;
 
   return g_variant_ref_sink (g_variant_dict_end (&dict));
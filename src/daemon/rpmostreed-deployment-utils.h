@@ -38,9 +38,11 @@ GVariant *      rpmostreed_deployment_generate_variant (OstreeSysroot    *sysroo
                                                         OstreeDeployment *deployment,
                                                         const char       *booted_id,
                                                         OstreeRepo       *repo,
+                                                        GHashTable       *gpg_cache,
                                                         GError          **error);
 
 GVariant *      rpmostreed_commit_generate_cached_details_variant (OstreeDeployment *deployment,
                                                                    OstreeRepo       *repo,
                                                                    const gchar      *refspec,
+                                                                   GHashTable       *gpg_cache,
                                                                    GError          **error);
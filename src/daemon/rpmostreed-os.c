@@ -420,7 +420,7 @@ os_handle_get_cached_update_rpm_diff (RPMOSTreeOS *interface,
 
   details = rpmostreed_commit_generate_cached_details_variant (base_deployment, ot_repo,
                                                                rpmostree_origin_get_refspec (origin),
-                                                               &local_error);
+                                                               NULL, &local_error);
   if (!details)
     goto out;
 
@@ -1405,7 +1405,7 @@ os_handle_get_cached_rebase_rpm_diff (RPMOSTreeOS *interface,
   details = rpmostreed_commit_generate_cached_details_variant (base_deployment,
                                                                ot_repo,
                                                                comp_ref,
-                                                               &local_error);
+                                                               NULL, &local_error);
   if (!details)
     goto out;
 
@@ -1541,7 +1541,7 @@ os_handle_get_cached_deploy_rpm_diff (RPMOSTreeOS *interface,
   details = rpmostreed_commit_generate_cached_details_variant (base_deployment,
                                                                ot_repo,
                                                                NULL,
-                                                               &local_error);
+                                                               NULL, &local_error);
   if (!details)
     goto out;
 
@@ -1614,6 +1614,29 @@ out:
   return TRUE;
 }
 
+/* Returns (transfer full) the variant for @deployment; normally this was
+ * already generated by the sysroot during the reload which triggered us.
+ */
+static GVariant *
+get_deployment_variant (RpmostreedSysroot *sysroot,
+                        OstreeDeployment  *deployment,
+                        const char        *booted_id,
+                        GError           **error)
+{
+  GVariant *variant = rpmostreed_sysroot_get_deployment_variant (sysroot, deployment);
+  if (variant)
+    return g_variant_ref (variant);
+
+  variant = rpmostreed_deployment_generate_variant (rpmostreed_sysroot_get_root (sysroot),
+                                                    deployment, booted_id,
+                                                    rpmostreed_sysroot_get_repo (sysroot),
+                                                    rpmostreed_sysroot_get_gpg_cache (sysroot),
+                                                    error);
+  if (!variant)
+    return NULL;
+  return g_variant_ref_sink (variant);
+}
+
 static gboolean
 rpmostreed_os_load_internals (RpmostreedOS *self, GError **error)
 {
@@ -1624,28 +1647,30 @@ rpmostreed_os_load_internals (RpmostreedOS *self, GError **error)
   glnx_unref_object  OstreeDeployment *merge_deployment = NULL; /* transfered */
 
   g_autoptr(GPtrArray) deployments = NULL;
+  RpmostreedSysroot *sysroot;
   OstreeSysroot *ot_sysroot;
   OstreeRepo *ot_repo;
-  GVariant *booted_variant = NULL;
-  GVariant *default_variant = NULL;
-  GVariant *rollback_variant = NULL;
+  g_autoptr(GVariant) booted_variant = NULL;
+  g_autoptr(GVariant) default_variant = NULL;
+  g_autoptr(GVariant) rollback_variant = NULL;
   g_autoptr(GVariant) cached_update = NULL;
   gboolean has_cached_updates = FALSE;
 
   name = rpmostree_os_get_name (RPMOSTREE_OS (self));
   g_debug ("loading %s", name);
 
-  ot_sysroot = rpmostreed_sysroot_get_root (rpmostreed_sysroot_get ());
-  ot_repo = rpmostreed_sysroot_get_repo (rpmostreed_sysroot_get ());
+  sysroot = rpmostreed_sysroot_get ();
+  ot_sysroot = rpmostreed_sysroot_get_root (sysroot);
+  ot_repo = rpmostreed_sysroot_get_repo (sysroot);
 
   booted = ostree_sysroot_get_booted_deployment (ot_sysroot);
+  if (booted)
+    booted_id = rpmostreed_deployment_generate_id (booted);
   if (booted && g_strcmp0 (ostree_deployment_get_osname (booted), name) == 0)
     {
-      booted_variant = rpmostreed_deployment_generate_variant (ot_sysroot, booted, booted_id,
-                                                               ot_repo, error);
+      booted_variant = get_deployment_variant (sysroot, booted, booted_id, error);
       if (!booted_variant)
         return FALSE;
-      booted_id = rpmostreed_deployment_generate_id (booted);
     }
 
   deployments = ostree_sysroot_get_deployments (ot_sysroot);
@@ -1653,10 +1678,8 @@ rpmostreed_os_load_internals (RpmostreedOS *self, GError **error)
     {
       if (g_strcmp0 (ostree_deployment_get_osname (deployments->pdata[i]), name) == 0)
         {
-          default_variant = rpmostreed_deployment_generate_variant (ot_sysroot,
-                                                                    deployments->pdata[i],
-                                                                    booted_id,
-                                                                    ot_repo, error);
+          default_variant = get_deployment_variant (sysroot, deployments->pdata[i],
+                                                    booted_id, error);
           if (default_variant == NULL)
             return FALSE;
           break;
@@ -1672,8 +1695,7 @@ rpmostreed_os_load_internals (RpmostreedOS *self, GError **error)
 
       if (rollback)
         {
-          rollback_variant = rpmostreed_deployment_generate_variant (ot_sysroot, rollback, booted_id,
-                                                                     ot_repo, error);
+          rollback_variant = get_deployment_variant (sysroot, rollback, booted_id, error);
           if (!rollback_variant)
             return FALSE;
         }
@@ -1691,6 +1713,7 @@ rpmostreed_os_load_internals (RpmostreedOS *self, GError **error)
           cached_update = rpmostreed_commit_generate_cached_details_variant (merge_deployment,
                                                                              ot_repo,
                                                                              rpmostree_origin_get_refspec (origin),
+                                                                             rpmostreed_sysroot_get_gpg_cache (sysroot),
                                                                              error);
           if (!cached_update)
             return FALSE;
@@ -1699,17 +1722,17 @@ rpmostreed_os_load_internals (RpmostreedOS *self, GError **error)
    }
 
   if (!booted_variant)
-    booted_variant = rpmostreed_deployment_generate_blank_variant ();
+    booted_variant = g_variant_ref_sink (rpmostreed_deployment_generate_blank_variant ());
   rpmostree_os_set_booted_deployment (RPMOSTREE_OS (self),
                                       booted_variant);
 
   if (!default_variant)
-    default_variant = rpmostreed_deployment_generate_blank_variant ();
+    default_variant = g_variant_ref_sink (rpmostreed_deployment_generate_blank_variant ());
   rpmostree_os_set_default_deployment (RPMOSTREE_OS (self),
                                        default_variant);
 
   if (!rollback_variant)
-    rollback_variant = rpmostreed_deployment_generate_blank_variant ();
+    rollback_variant = g_variant_ref_sink (rpmostreed_deployment_generate_blank_variant ());
   rpmostree_os_set_rollback_deployment (RPMOSTREE_OS (self),
                                         rollback_variant);
 
@@ -68,6 +68,12 @@ struct _RpmostreedSysroot {
   GHashTable *os_interfaces;
   GHashTable *osexperimental_interfaces;
 
+  /* Regenerated on each reload, and shared with the OS interfaces so that
+   * each deployment's commits are loaded and GPG verified only once.
+   */
+  GHashTable *deployment_variants; /* deployment id --> GVariant */
+  GHashTable *gpg_cache; /* remote:checksum --> GVariant */
+
   /* The OS interface's various diff methods can run concurrently with
    * transactions, which is safe except when the transaction is writing
    * new deployments to disk or downloading RPM package details.  The
@@ -303,6 +309,11 @@ sysroot_populate_deployments_unlocked (RpmostreedSysroot *self,
   GVariantBuilder builder;
   g_variant_builder_init (&builder, G_VARIANT_TYPE ("aa{sv}"));
 
+  g_autoptr(GHashTable) deployment_variants =
+    g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_variant_unref);
+  g_autoptr(GHashTable) gpg_cache =
+    g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_variant_unref);
+
   g_autoptr(GHashTable) seen_osnames =
     g_hash_table_new_full (g_str_hash, g_str_equal, NULL, NULL);
 
@@ -321,7 +332,7 @@ sysroot_populate_deployments_unlocked (RpmostreedSysroot *self,
       rpmostree_sysroot_set_booted (RPMOSTREE_SYSROOT (self), "/");
     }
 
-  /* Add deployment interfaces */
+  /* Generate the deployment variants first; the OS interfaces use them too */
   g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments (self->ot_sysroot);
 
   for (guint i = 0; deployments != NULL && i < deployments->len; i++)
@@ -329,12 +340,25 @@ sysroot_populate_deployments_unlocked (RpmostreedSysroot *self,
       OstreeDeployment *deployment = deployments->pdata[i];
       GVariant *variant =
         rpmostreed_deployment_generate_variant (self->ot_sysroot, deployment,
-                                                booted_id, self->repo, error);
+                                                booted_id, self->repo, gpg_cache, error);
       if (!variant)
         return glnx_prefix_error (error, "Reading deployment %u", i);
 
+      g_variant_ref_sink (variant);
       g_variant_builder_add_value (&builder, variant);
+      g_hash_table_insert (deployment_variants,
+                           rpmostreed_deployment_generate_id (deployment), variant);
+    }
 
+  g_clear_pointer (&self->deployment_variants, g_hash_table_unref);
+  self->deployment_variants = g_steal_pointer (&deployment_variants);
+  g_clear_pointer (&self->gpg_cache, g_hash_table_unref);
+  self->gpg_cache = g_steal_pointer (&gpg_cache);
+
+  /* Add deployment interfaces */
+  for (guint i = 0; deployments != NULL && i < deployments->len; i++)
+    {
+      OstreeDeployment *deployment = deployments->pdata[i];
       const char *deployment_os = ostree_deployment_get_osname (deployment);
 
       /* Have we not seen this osname instance before?  If so, add it
@@ -480,6 +504,8 @@ sysroot_finalize (GObject *object)
 
   g_hash_table_unref (self->os_interfaces);
   g_hash_table_unref (self->osexperimental_interfaces);
+  g_clear_pointer (&self->deployment_variants, g_hash_table_unref);
+  g_clear_pointer (&self->gpg_cache, g_hash_table_unref);
 
   g_clear_object (&self->monitor);
 
@@ -785,6 +811,26 @@ rpmostreed_sysroot_get_repo (RpmostreedSysroot *self)
   return self->repo;
 }
 
+/* Returns (transfer none) the variant for @deployment generated during the
+ * last reload, or %NULL if it isn't known.
+ */
+GVariant *
+rpmostreed_sysroot_get_deployment_variant (RpmostreedSysroot *self,
+                                           OstreeDeployment  *deployment)
+{
+  if (!self->deployment_variants)
+    return NULL;
+  g_autofree char *id = rpmostreed_deployment_generate_id (deployment);
+  return g_hash_table_lookup (self->deployment_variants, id);
+}
+
+/* Returns (transfer none) the GPG verification cache for the current reload */
+GHashTable *
+rpmostreed_sysroot_get_gpg_cache (RpmostreedSysroot *self)
+{
+  return self->gpg_cache;
+}
+
 PolkitAuthority *
 rpmostreed_sysroot_get_polkit_authority (RpmostreedSysroot *self)
 {
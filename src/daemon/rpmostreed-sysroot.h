@@ -40,6 +40,9 @@ gboolean            rpmostreed_sysroot_reload           (RpmostreedSysroot *self
 
 OstreeSysroot *     rpmostreed_sysroot_get_root         (RpmostreedSysroot *self);
 OstreeRepo *        rpmostreed_sysroot_get_repo         (RpmostreedSysroot *self);
+GVariant *          rpmostreed_sysroot_get_deployment_variant (RpmostreedSysroot *self,
+                                                               OstreeDeployment  *deployment);
+GHashTable *        rpmostreed_sysroot_get_gpg_cache    (RpmostreedSysroot *self);
 PolkitAuthority *   rpmostreed_sysroot_get_polkit_authority (RpmostreedSysroot *self);
 gboolean            rpmostreed_sysroot_is_on_session_bus    (RpmostreedSysroot *self);
 
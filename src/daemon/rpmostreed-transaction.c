@@ -163,9 +163,33 @@ transaction_owner_vanished_cb (GDBusConnection *connection,
     }
 }
 
+/* Default maximum rate of DownloadProgress signals; can be overridden via
+ * $RPMOSTREE_DAEMON_PROGRESS_HZ, where 0 disables throttling.
+ */
+#define DEFAULT_PROGRESS_HZ 10
+
+static guint
+get_progress_min_interval_usec (void)
+{
+  static gsize initialized;
+  static guint interval_usec;
+
+  if (g_once_init_enter (&initialized))
+    {
+      guint64 hz = DEFAULT_PROGRESS_HZ;
+      const char *hz_str = g_getenv ("RPMOSTREE_DAEMON_PROGRESS_HZ");
+      if (hz_str)
+        hz = g_ascii_strtoull (hz_str, NULL, 10);
+      interval_usec = hz > 0 ? G_USEC_PER_SEC / MIN (hz, G_USEC_PER_SEC) : 0;
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return interval_usec;
+}
+
 static void
-transaction_progress_changed_cb (OstreeAsyncProgress *progress,
-                                 RPMOSTreeTransaction *transaction)
+emit_download_progress (OstreeAsyncProgress *progress,
+                        RPMOSTreeTransaction *transaction)
 {
   guint64 start_time = ostree_async_progress_get_uint64 (progress, "start-time");
   guint64 elapsed_secs = 0;
@@ -206,7 +230,7 @@ transaction_progress_changed_cb (OstreeAsyncProgress *progress,
 
   if (start_time)
     {
-      guint64 elapsed_secs = (g_get_monotonic_time () - start_time) / G_USEC_PER_SEC;
+      elapsed_secs = (g_get_monotonic_time () - start_time) / G_USEC_PER_SEC;
       if (elapsed_secs)
         bytes_sec = bytes_transferred / elapsed_secs;
     }
@@ -248,6 +272,90 @@ transaction_progress_changed_cb (OstreeAsyncProgress *progress,
                                                 arg_transfer);
 }
 
+/* Per-OstreeAsyncProgress state for coalescing DownloadProgress signals; a
+ * large pull can change the progress thousands of times per second, and every
+ * signal is marshalled and sent to every client.
+ */
+typedef struct {
+  OstreeAsyncProgress *progress; /* Unowned; this struct is attached to it */
+  GWeakRef transaction;
+  gint64 last_emit_time;
+  GSource *timeout_source;
+} ProgressThrottle;
+
+static void
+progress_throttle_free (ProgressThrottle *throttle)
+{
+  if (throttle->timeout_source)
+    {
+      g_source_destroy (throttle->timeout_source);
+      g_source_unref (throttle->timeout_source);
+    }
+  g_weak_ref_clear (&throttle->transaction);
+  g_free (throttle);
+}
+
+static void
+progress_throttle_emit (ProgressThrottle *throttle)
+{
+  g_autoptr(GObject) transaction = g_weak_ref_get (&throttle->transaction);
+  throttle->last_emit_time = g_get_monotonic_time ();
+  if (transaction)
+    emit_download_progress (throttle->progress, RPMOSTREE_TRANSACTION (transaction));
+}
+
+static gboolean
+progress_throttle_timeout_cb (gpointer user_data)
+{
+  ProgressThrottle *throttle = user_data;
+
+  g_clear_pointer (&throttle->timeout_source, (GDestroyNotify)g_source_unref);
+  progress_throttle_emit (throttle);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+transaction_progress_changed_cb (OstreeAsyncProgress *progress,
+                                 RPMOSTreeTransaction *transaction)
+{
+  ProgressThrottle *throttle = g_object_get_data (G_OBJECT (progress), "rpmostreed-throttle");
+  const guint min_interval = get_progress_min_interval_usec ();
+  g_assert (throttle);
+
+  /* Always send status messages, and the state whenever nothing is in flight;
+   * the latter covers phase transitions as well as the final state (the pull
+   * calls ostree_async_progress_finish() once it's drained).
+   */
+  g_autofree char *status = ostree_async_progress_get_status (progress);
+  const gboolean idle =
+    ostree_async_progress_get_uint (progress, "outstanding-fetches") == 0 &&
+    ostree_async_progress_get_uint (progress, "outstanding-writes") == 0 &&
+    ostree_async_progress_get_uint (progress, "outstanding-metadata-fetches") == 0;
+  const gint64 now = g_get_monotonic_time ();
+  const gint64 next_emit_time = throttle->last_emit_time + min_interval;
+
+  if (status || idle || min_interval == 0 || now >= next_emit_time)
+    {
+      if (throttle->timeout_source)
+        {
+          g_source_destroy (throttle->timeout_source);
+          g_clear_pointer (&throttle->timeout_source, (GDestroyNotify)g_source_unref);
+        }
+      progress_throttle_emit (throttle);
+    }
+  else if (!throttle->timeout_source)
+    {
+      /* Otherwise, make sure the latest state goes out once the interval has
+       * elapsed; this coalesces all changes until then into one signal.
+       */
+      const guint delay_ms = MAX ((next_emit_time - now) / 1000, 1);
+      throttle->timeout_source = g_timeout_source_new (delay_ms);
+      g_source_set_callback (throttle->timeout_source, progress_throttle_timeout_cb,
+                             throttle, NULL);
+      g_source_attach (throttle->timeout_source, g_main_context_get_thread_default ());
+    }
+}
+
 static void
 transaction_gpg_verify_result_cb (OstreeRepo *repo,
                                   const char *checksum,
@@ -806,6 +914,12 @@ rpmostreed_transaction_connect_download_progress (RpmostreedTransaction *transac
   g_return_if_fail (RPMOSTREED_IS_TRANSACTION (transaction));
   g_return_if_fail (OSTREE_IS_ASYNC_PROGRESS (progress));
 
+  ProgressThrottle *throttle = g_new0 (ProgressThrottle, 1);
+  throttle->progress = progress;
+  g_weak_ref_init (&throttle->transaction, transaction);
+  g_object_set_data_full (G_OBJECT (progress), "rpmostreed-throttle", throttle,
+                          (GDestroyNotify)progress_throttle_free);
+
   g_signal_connect_object (progress,
                            "changed",
                            G_CALLBACK (transaction_progress_changed_cb),
@@ -59,6 +59,8 @@ struct _RpmOstreeContext {
   GHashTable *pkgs_to_remove;  /* pkgname --> gv_nevra */
   GHashTable *pkgs_to_replace; /* new gv_nevra --> old gv_nevra */
 
+  GHashTable *pkgcache_commit_info; /* pkgcache commit --> PkgCacheCommitInfo */
+
   GLnxTmpDir tmpdir;
 
   int tmprootfs_dfd; /* Borrowed */
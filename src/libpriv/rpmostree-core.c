@@ -31,6 +31,7 @@
 #include <systemd/sd-journal.h>
 #include <libdnf/libdnf.h>
 #include <librepo/librepo.h>
+#include <gpgme.h>
 
 #include "rpmostree-core-private.h"
 #include "rpmostree-jigdo-core.h"
@@ -48,6 +49,7 @@
 
 #define RPMOSTREE_DIR_CACHE_REPOMD "repomd"
 #define RPMOSTREE_DIR_CACHE_SOLV "solv"
+#define RPMOSTREE_DIR_CACHE_PKGCACHE_HEADERS "pkgcache-headers"
 #define RPMOSTREE_DIR_LOCK "lock"
 
 static OstreeRepo * get_pkgcache_repo (RpmOstreeContext *self);
@@ -282,6 +284,8 @@ rpmostree_context_finalize (GObject *object)
   g_clear_pointer (&rctx->pkgs_to_remove, g_hash_table_unref);
   g_clear_pointer (&rctx->pkgs_to_replace, g_hash_table_unref);
 
+  g_clear_pointer (&rctx->pkgcache_commit_info, g_hash_table_unref);
+
   (void)glnx_tmpdir_delete (&rctx->tmpdir, NULL, NULL);
   (void)glnx_tmpdir_delete (&rctx->repo_tmpdir, NULL, NULL);
 
@@ -513,6 +517,77 @@ rpmostree_context_get_rpmmd_repo_commit_metadata (RpmOstreeContext  *self)
   return g_variant_ref_sink (g_variant_builder_end (&repo_list_builder));
 }
 
+/* Compute the package list of the assembled root from what we already have in
+ * memory: the packages of the base rpmdb (if any) minus the ones the goal
+ * removes or replaces, plus the ones it installs. This saves reloading the
+ * rpmdb we just wrote.
+ *
+ * Returns %NULL if we never depsolved (e.g. the context was marked empty via
+ * rpmostree_context_set_is_empty()), in which case the caller should read the
+ * rpmdb instead.
+ */
+GVariant *
+rpmostree_context_get_rpmdb_pkglist (RpmOstreeContext *self)
+{
+  DnfSack *sack = dnf_context_get_sack (self->dnfctx);
+  if (!sack)
+    return NULL;
+  HyGoal goal = dnf_context_get_goal (self->dnfctx);
+
+  /* nevra --> DnfPackage */
+  g_autoptr(GHashTable) pkgs =
+    g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_object_unref);
+  g_autoptr(GPtrArray) base_pkgs = rpmostree_sack_get_packages (sack);
+  for (guint i = 0; i < base_pkgs->len; i++)
+    {
+      DnfPackage *pkg = base_pkgs->pdata[i];
+      g_hash_table_replace (pkgs, (char*)dnf_package_get_nevra (pkg), g_object_ref (pkg));
+    }
+
+  g_autoptr(GPtrArray) removed =
+    dnf_goal_get_packages (goal, DNF_PACKAGE_INFO_REMOVE, DNF_PACKAGE_INFO_OBSOLETE, -1);
+  for (guint i = 0; i < removed->len; i++)
+    g_hash_table_remove (pkgs, dnf_package_get_nevra (removed->pdata[i]));
+
+  /* the goal only gives us the new half of replacements; drop whatever we had
+   * with the same name and arch */
+  g_autoptr(GPtrArray) replaced =
+    dnf_goal_get_packages (goal, DNF_PACKAGE_INFO_UPDATE, DNF_PACKAGE_INFO_DOWNGRADE, -1);
+  if (replaced->len > 0)
+    {
+      g_autoptr(GHashTable) replaced_names = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                                    g_free, NULL);
+      for (guint i = 0; i < replaced->len; i++)
+        {
+          DnfPackage *pkg = replaced->pdata[i];
+          g_hash_table_add (replaced_names, g_strconcat (dnf_package_get_name (pkg), ".",
+                                                         dnf_package_get_arch (pkg), NULL));
+        }
+
+      GLNX_HASH_TABLE_FOREACH_IT (pkgs, it, const char*, nevra, DnfPackage*, pkg)
+        {
+          g_autofree char *namearch = g_strconcat (dnf_package_get_name (pkg), ".",
+                                                   dnf_package_get_arch (pkg), NULL);
+          if (g_hash_table_contains (replaced_names, namearch))
+            g_hash_table_iter_remove (&it);
+        }
+    }
+
+  g_autoptr(GPtrArray) installed =
+    dnf_goal_get_packages (goal, DNF_PACKAGE_INFO_INSTALL, DNF_PACKAGE_INFO_UPDATE,
+                           DNF_PACKAGE_INFO_DOWNGRADE, -1);
+  for (guint i = 0; i < installed->len; i++)
+    {
+      DnfPackage *pkg = installed->pdata[i];
+      g_hash_table_replace (pkgs, (char*)dnf_package_get_nevra (pkg), g_object_ref (pkg));
+    }
+
+  g_autoptr(GPtrArray) pkglist = g_ptr_array_new_with_free_func (g_object_unref);
+  GLNX_HASH_TABLE_FOREACH_V (pkgs, DnfPackage*, pkg)
+    g_ptr_array_add (pkglist, g_object_ref (pkg));
+  return rpmostree_create_pkglist_variant (pkglist);
+}
+
 GHashTable *
 rpmostree_dnfcontext_get_varsubsts (DnfContext *context)
 {
@@ -970,6 +1045,106 @@ rpmostree_get_nevra_from_pkgcache (OstreeRepo  *repo,
   return TRUE;
 }
 
+/* Upper bound on rpm-md repos we check/update at once */
+#define RPMOSTREE_MAX_CONCURRENT_REPO_REFRESH 4
+
+typedef struct {
+  DnfRepo *repo;
+  guint cache_age;
+  gboolean *out_did_update;
+} RepoRefreshTaskData;
+
+typedef struct {
+  guint n_running;
+  guint n_done;
+  guint n_total;
+  GCancellable *cancellable;
+  GError *error;
+} RepoRefreshState;
+
+/* A note on thread safety: each DnfRepo has its own librepo handle and result,
+ * and librepo is safe to use concurrently as long as handles aren't shared. The
+ * DnfContext is only read from (cache age, directories). Each repo also has its
+ * own GPG keyring directory. The remaining piece of global state is gpgme,
+ * whose initialization isn't thread-safe; we take care of that up front in
+ * rpmostree_context_download_metadata().
+ */
+static void
+refresh_repo_in_thread (GTask            *task,
+                        gpointer          source,
+                        gpointer          task_data,
+                        GCancellable     *cancellable)
+{
+  g_autoptr(GError) local_error = NULL;
+  RepoRefreshTaskData *tdata = task_data;
+  g_autoptr(DnfState) hifstate = dnf_state_new ();
+
+  if (!dnf_repo_check (tdata->repo, tdata->cache_age, hifstate, NULL))
+    {
+      if (g_cancellable_set_error_if_cancelled (cancellable, &local_error))
+        {
+          g_task_return_error (task, g_steal_pointer (&local_error));
+          return;
+        }
+
+      dnf_state_reset (hifstate);
+      if (!dnf_repo_update (tdata->repo, DNF_REPO_UPDATE_FLAG_FORCE, hifstate, &local_error))
+        {
+          g_prefix_error (&local_error, "Updating metadata for '%s': ", dnf_repo_get_id (tdata->repo));
+          g_task_return_error (task, g_steal_pointer (&local_error));
+          return;
+        }
+      *tdata->out_did_update = TRUE;
+    }
+  g_task_return_boolean (task, TRUE);
+}
+
+/* Check the cache state of @repo, and if it's out of date, update it; all in a
+ * worker thread.  We don't hook up progress here since the repos are updated in
+ * parallel, and per-repo percentages would just fight over the console.
+ */
+static void
+refresh_repo_async (RpmOstreeContext   *self,
+                    DnfRepo            *repo,
+                    gboolean           *out_did_update,
+                    GCancellable       *cancellable,
+                    GAsyncReadyCallback callback,
+                    gpointer            user_data)
+{
+  g_autoptr(GTask) task = g_task_new (self, cancellable, callback, user_data);
+  RepoRefreshTaskData *tdata = g_new (RepoRefreshTaskData, 1);
+  /* We can assume lifetime is greater than the task */
+  tdata->repo = repo;
+  tdata->cache_age = dnf_context_get_cache_age (self->dnfctx);
+  tdata->out_did_update = out_did_update;
+  g_task_set_task_data (task, tdata, g_free);
+  g_task_run_in_thread (task, refresh_repo_in_thread);
+}
+
+static void
+on_async_repo_refreshed (GObject      *obj,
+                         GAsyncResult *res,
+                         gpointer      user_data)
+{
+  RepoRefreshState *state = user_data;
+  if (!g_task_propagate_boolean (G_TASK (res), state->error ? NULL : &state->error))
+    {
+      if (state->cancellable)
+        g_cancellable_cancel (state->cancellable);
+    }
+  g_assert_cmpint (state->n_running, >, 0);
+  state->n_running--;
+  state->n_done++;
+  rpmostree_output_progress_n_items ("Updating metadata", state->n_done, state->n_total);
+}
+
+static void
+on_refresh_parent_cancelled (GCancellable *parent,
+                             gpointer      user_data)
+{
+  g_cancellable_cancel (user_data);
+}
+
 /* Initiate download of rpm-md */
 gboolean
 rpmostree_context_download_metadata (RpmOstreeContext *self,
@@ -978,6 +1153,8 @@ rpmostree_context_download_metadata (RpmOstreeContext *self,
 {
   g_assert (!self->empty);
 
+  g_auto(RpmOstreeOutputPhase) phase = rpmostree_output_phase_begin ("metadata");
+
   g_autoptr(GPtrArray) rpmmd_repos =
     get_enabled_rpmmd_repos (self->dnfctx, DNF_REPO_ENABLED_PACKAGES);
 
@@ -1002,40 +1179,64 @@ rpmostree_context_download_metadata (RpmOstreeContext *self,
     }
   rpmostree_output_message ("%s", enabled_repos->str);
 
-  /* Update each repo individually, and print its timestamp, so users can keep
-   * track of repo up-to-dateness more easily.
+  /* Check and update the repos concurrently; on high-latency links, the round
+   * trips for repomd.xml and friends dominate.
    */
-  for (guint i = 0; i < rpmmd_repos->len; i++)
-    {
-      DnfRepo *repo = rpmmd_repos->pdata[i];
-      g_autoptr(DnfState) hifstate = dnf_state_new ();
+  g_autofree gboolean *did_update = g_new0 (gboolean, rpmmd_repos->len);
+  /* We cancel the remaining refreshes on the first failure; use our own
+   * cancellable for that so we don't cancel the caller's whole operation.
+   */
+  g_autoptr(GCancellable) refresh_cancellable = g_cancellable_new ();
+  gulong cancel_handler = 0;
+  if (cancellable)
+    cancel_handler = g_cancellable_connect (cancellable,
+                                            G_CALLBACK (on_refresh_parent_cancelled),
+                                            refresh_cancellable, NULL);
+  /* gpgme must be initialized once before it's used from multiple threads;
+   * librepo and libdnf call this lazily from the workers otherwise.
+   */
+  (void) gpgme_check_version (NULL);
 
-      /* Until libdnf speaks GCancellable: https://github.com/projectatomic/rpm-ostree/issues/897 */
-      if (g_cancellable_set_error_if_cancelled (cancellable, error))
-        return FALSE;
+  RepoRefreshState state = { 0, };
+  state.cancellable = refresh_cancellable;
+  state.n_total = rpmmd_repos->len;
+  { GMainContext *mainctx = g_main_context_get_thread_default ();
+    for (guint i = 0; i < rpmmd_repos->len; i++)
+      {
+        while (state.n_running >= RPMOSTREE_MAX_CONCURRENT_REPO_REFRESH)
+          g_main_context_iteration (mainctx, TRUE);
 
-      gboolean did_update = FALSE;
-      if (!dnf_repo_check(repo,
-                          dnf_context_get_cache_age (self->dnfctx),
-                          hifstate,
-                          NULL))
-        {
-          dnf_state_reset (hifstate);
-          g_autofree char *prefix = g_strdup_printf ("Updating metadata for '%s':",
-                                                     dnf_repo_get_id (repo));
-          guint progress_sigid = g_signal_connect (hifstate, "percentage-changed",
-                                                   G_CALLBACK (on_hifstate_percentage_changed),
-                                                   prefix);
-
-          if (!dnf_repo_update (repo, DNF_REPO_UPDATE_FLAG_FORCE, hifstate, error))
-            return FALSE;
+        /* Until libdnf speaks GCancellable: https://github.com/projectatomic/rpm-ostree/issues/897 */
+        if (state.error || g_cancellable_is_cancelled (refresh_cancellable))
+          break;
 
-          did_update = TRUE;
+        state.n_running++;
+        refresh_repo_async (self, rpmmd_repos->pdata[i], &did_update[i],
+                            refresh_cancellable, on_async_repo_refreshed, &state);
+      }
+    while (state.n_running > 0)
+      g_main_context_iteration (mainctx, TRUE);
+  }
+  if (cancellable)
+    g_cancellable_disconnect (cancellable, cancel_handler);
+  if (state.n_done > 0)
+    rpmostree_output_progress_end ();
 
-          g_signal_handler_disconnect (hifstate, progress_sigid);
-          rpmostree_output_progress_end ();
-        }
+  if (state.error)
+    {
+      g_propagate_error (error, state.error);
+      return FALSE;
+    }
+  /* We may have stopped early with some repos not refreshed */
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return FALSE;
 
+  /* Print each repo's timestamp, so users can keep track of repo
+   * up-to-dateness more easily.
+   */
+  for (guint i = 0; i < rpmmd_repos->len; i++)
+    {
+      DnfRepo *repo = rpmmd_repos->pdata[i];
       guint64 ts = dnf_repo_get_timestamp_generated (repo);
       g_autoptr(GDateTime) repo_ts = g_date_time_new_from_unix_utc (ts);
       g_autofree char *repo_ts_str = NULL;
@@ -1046,7 +1247,7 @@ rpmostree_context_download_metadata (RpmOstreeContext *self,
         repo_ts_str = g_strdup_printf ("(invalid timestamp)");
 
       rpmostree_output_message ("rpm-md repo '%s'%s; generated: %s",
-                                dnf_repo_get_id (repo), !did_update ? " (cached)" : "",
+                                dnf_repo_get_id (repo), !did_update[i] ? " (cached)" : "",
                                 repo_ts_str);
     }
 
@@ -1224,27 +1425,6 @@ get_pkgcache_repodata_chksum_repr (GVariant    *commit,
   return TRUE;
 }
 
-static gboolean
-commit_has_matching_repodata_chksum_repr (GVariant    *commit,
-                                          const char  *expected,
-                                          gboolean    *out_matches,
-                                          GError     **error)
-{
-  g_autofree char *chksum_repr = NULL;
-  if (!get_pkgcache_repodata_chksum_repr (commit, &chksum_repr, TRUE, error))
-    return FALSE;
-
-  /* never match pkgs unpacked with older versions that didn't embed chksum_repr */
-  if (chksum_repr == NULL)
-    {
-      *out_matches = FALSE;
-      return TRUE;
-    }
-
-  *out_matches = g_str_equal (expected, chksum_repr);
-  return TRUE;
-}
-
 static gboolean
 pkg_is_cached (DnfPackage *pkg)
 {
@@ -1261,12 +1441,67 @@ pkg_is_cached (DnfPackage *pkg)
   return g_file_test (dnf_package_get_filename (pkg), G_FILE_TEST_EXISTS);
 }
 
+/* The subset of pkgcache commit metadata that sort_packages() needs */
+typedef struct {
+  char *repodata_chksum_repr; /* NULL for imports by older versions */
+  char *sepolicy_csum;        /* NULL if not recorded */
+  gboolean nodocs;
+} PkgCacheCommitInfo;
+
+static void
+pkgcache_commit_info_free (PkgCacheCommitInfo *info)
+{
+  g_free (info->repodata_chksum_repr);
+  g_free (info->sepolicy_csum);
+  g_free (info);
+}
+
+/* Return (transfer none) the metadata of pkgcache commit @rev. Commits are
+ * immutable, so we keep the parsed results around for the lifetime of the
+ * context; sort_packages() may run multiple times (e.g. in jigdo mode).
+ */
+static PkgCacheCommitInfo *
+get_pkgcache_commit_info (RpmOstreeContext *self,
+                          OstreeRepo       *repo,
+                          const char       *rev,
+                          GError          **error)
+{
+  if (!self->pkgcache_commit_info)
+    self->pkgcache_commit_info =
+      g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                             (GDestroyNotify)pkgcache_commit_info_free);
+
+  PkgCacheCommitInfo *info = g_hash_table_lookup (self->pkgcache_commit_info, rev);
+  if (info)
+    return info;
+
+  g_autoptr(GVariant) commit = NULL;
+  if (!ostree_repo_load_commit (repo, rev, &commit, NULL, error))
+    return NULL;
+  g_assert (commit);
+  g_autoptr(GVariant) metadata = g_variant_get_child_value (commit, 0);
+  g_autoptr(GVariantDict) metadata_dict = g_variant_dict_new (metadata);
+
+  info = g_new0 (PkgCacheCommitInfo, 1);
+  g_variant_dict_lookup (metadata_dict, "rpmostree.repodata_checksum", "s",
+                         &info->repodata_chksum_repr);
+  g_variant_dict_lookup (metadata_dict, "rpmostree.sepolicy", "s",
+                         &info->sepolicy_csum);
+  if (!g_variant_dict_lookup (metadata_dict, "rpmostree.nodocs", "b", &info->nodocs))
+    info->nodocs = FALSE;
+
+  g_hash_table_insert (self->pkgcache_commit_info, g_strdup (rev), info);
+  return info;
+}
+
 /* Given @pkg, return its state in the pkgcache repo. It could be not present,
  * or present but have been imported with a different SELinux policy version
- * (and hence in need of relabeling).
+ * (and hence in need of relabeling). @pkgcache_refs is the set of
+ * rpmostree/pkg refs in the pkgcache, listed once by the caller.
  */
 static gboolean
 find_pkg_in_ostree (RpmOstreeContext *self,
+                    GHashTable     *pkgcache_refs,
                     DnfPackage     *pkg,
                     OstreeSePolicy *sepolicy,
                     gboolean       *out_in_ostree,
@@ -1282,20 +1517,13 @@ find_pkg_in_ostree (RpmOstreeContext *self,
     return TRUE; /* Note early return */
 
   g_autofree char *cachebranch = rpmostree_get_cache_branch_pkg (pkg);
-  g_autofree char *cached_rev = NULL;
-  if (!ostree_repo_resolve_rev (repo, cachebranch, TRUE,
-                                &cached_rev, error))
-    return FALSE;
-
+  const char *cached_rev = g_hash_table_lookup (pkgcache_refs, cachebranch);
   if (!cached_rev)
     return TRUE; /* Note early return */
 
-  g_autoptr(GVariant) commit = NULL;
-  if (!ostree_repo_load_commit (repo, cached_rev, &commit, NULL, error))
+  PkgCacheCommitInfo *info = get_pkgcache_commit_info (self, repo, cached_rev, error);
+  if (!info)
     return FALSE;
-  g_assert (commit);
-  g_autoptr(GVariant) metadata = g_variant_get_child_value (commit, 0);
-  g_autoptr(GVariantDict) metadata_dict = g_variant_dict_new (metadata);
 
   /* NB: we do an exception for LocalPackages here; we've already checked that
    * its cache is valid and matches what's in the origin. We never want to fetch
@@ -1310,13 +1538,9 @@ find_pkg_in_ostree (RpmOstreeContext *self,
                                                error))
         return FALSE;
 
-      gboolean same_pkg_chksum = FALSE;
-      if (!commit_has_matching_repodata_chksum_repr (commit,
-                                                     expected_chksum_repr,
-                                                     &same_pkg_chksum, error))
-        return FALSE;
-
-      if (!same_pkg_chksum)
+      /* never match pkgs unpacked with older versions that didn't embed chksum_repr */
+      if (!info->repodata_chksum_repr ||
+          !g_str_equal (expected_chksum_repr, info->repodata_chksum_repr))
         return TRUE; /* Note early return */
 
       /* We need to handle things like the nodocs flag changing; in that case we
@@ -1326,14 +1550,10 @@ find_pkg_in_ostree (RpmOstreeContext *self,
       g_variant_dict_lookup (self->spec->dict, "documentation", "b", &global_docs);
       const gboolean global_nodocs = !global_docs;
 
-      gboolean pkgcache_commit_is_nodocs;
-      if (!g_variant_dict_lookup (metadata_dict, "rpmostree.nodocs", "b", &pkgcache_commit_is_nodocs))
-        pkgcache_commit_is_nodocs = FALSE;
-
       /* We treat a mismatch of documentation state as simply not being
        * imported at all.
        */
-      if (global_nodocs != pkgcache_commit_is_nodocs)
+      if (global_nodocs != info->nodocs)
         return TRUE;
     }
 
@@ -1341,9 +1561,10 @@ find_pkg_in_ostree (RpmOstreeContext *self,
   *out_in_ostree = TRUE;
   if (sepolicy)
     {
-      if (!commit_has_matching_sepolicy (commit, sepolicy,
-                                         out_selinux_match, error))
-        return FALSE;
+      if (!info->sepolicy_csum)
+        return glnx_throw (error, "Commit %s is missing rpmostree.sepolicy", cached_rev);
+      *out_selinux_match = g_str_equal (info->sepolicy_csum,
+                                        ostree_sepolicy_get_csum (sepolicy));
     }
 
   return TRUE;
@@ -1368,7 +1589,25 @@ sort_packages (RpmOstreeContext *self,
   self->pkgs_to_relabel = g_ptr_array_new_with_free_func ((GDestroyNotify)g_object_unref);
   self->n_async_pkgs_relabeled = 0;
 
+  /* Index the repos by id rather than scanning them for every package */
+  g_autoptr(GHashTable) sources_by_id = g_hash_table_new (g_str_hash, g_str_equal);
   GPtrArray *sources = dnf_context_get_repos (dnfctx);
+  for (guint i = 0; i < sources->len; i++)
+    {
+      DnfRepo *src = sources->pdata[i];
+      g_hash_table_insert (sources_by_id, (char*)dnf_repo_get_id (src), src);
+    }
+
+  /* Similarly, list the pkgcache refs once instead of resolving each branch */
+  g_autoptr(GHashTable) pkgcache_refs = NULL;
+  OstreeRepo *pkgcache_repo = get_pkgcache_repo (self);
+  if (pkgcache_repo)
+    {
+      if (!ostree_repo_list_refs_ext (pkgcache_repo, "rpmostree/pkg", &pkgcache_refs,
+                                      OSTREE_REPO_LIST_REFS_EXT_NONE, cancellable, error))
+        return FALSE;
+    }
+
   for (guint i = 0; i < packages->len; i++)
     {
       DnfPackage *pkg = packages->pdata[i];
@@ -1383,16 +1622,7 @@ sort_packages (RpmOstreeContext *self,
       /* make sure all the non-cached pkgs have their repos set */
       if (!is_locally_cached)
         {
-          DnfRepo *src = NULL;
-
-          /* Hackily look up the source...we need a hash table */
-          for (guint j = 0; j < sources->len && !src; j++)
-            {
-              DnfRepo *tmpsrc = sources->pdata[j];
-              if (g_strcmp0 (reponame, dnf_repo_get_id (tmpsrc)) == 0)
-                src = tmpsrc;
-            }
-
+          DnfRepo *src = g_hash_table_lookup (sources_by_id, reponame);
           g_assert (src);
           dnf_package_set_repo (pkg, src);
         }
@@ -1412,7 +1642,7 @@ sort_packages (RpmOstreeContext *self,
         gboolean selinux_match = FALSE;
         gboolean cached = pkg_is_cached (pkg);
 
-        if (!find_pkg_in_ostree (self, pkg, self->sepolicy,
+        if (!find_pkg_in_ostree (self, pkgcache_refs, pkg, self->sepolicy,
                                  &in_ostree, &selinux_match, error))
           return FALSE;
 
@@ -1614,6 +1844,13 @@ check_goal_solution (RpmOstreeContext *self,
   return TRUE;
 }
 
+/* Note this doesn't go through the persistent header cache used by
+ * add_remaining_pkgcache_pkgs(): it's only called for the packages explicitly
+ * layered or replaced, of which there are usually a handful, and verifying
+ * @sha256 requires loading the commit anyway. The header is also written to
+ * our tmpdir where librpm expects it during assembly, so this doesn't cost an
+ * extra write either.
+ */
 static gboolean
 install_pkg_from_cache (RpmOstreeContext *self,
                         const char       *nevra,
@@ -1638,9 +1875,43 @@ install_pkg_from_cache (RpmOstreeContext *self,
   return TRUE;
 }
 
+/* Remove any entries from the pkgcache header cache that don't correspond to a
+ * commit in @live_names.
+ */
+static gboolean
+prune_pkgcache_header_cache (int           hdrcache_dfd,
+                             GHashTable   *live_names,
+                             GCancellable *cancellable,
+                             GError      **error)
+{
+  g_auto(GLnxDirFdIterator) dfd_iter = { FALSE, };
+  if (!glnx_dirfd_iterator_init_at (hdrcache_dfd, ".", TRUE, &dfd_iter, error))
+    return FALSE;
+
+  while (TRUE)
+    {
+      struct dirent *dent = NULL;
+      if (!glnx_dirfd_iterator_next_dent (&dfd_iter, &dent, cancellable, error))
+        return FALSE;
+      if (dent == NULL)
+        break;
+      if (g_hash_table_contains (live_names, dent->d_name))
+        continue;
+      if (!glnx_unlinkat (dfd_iter.fd, dent->d_name, 0, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
 /* This is a hacky way to bridge the gap between libdnf and our pkgcache. We extract the
  * metarpm for every RPM in our cache and present that as the cmdline repo to libdnf. But we
  * do still want all the niceties of the libdnf stack, e.g. HyGoal, libsolv depsolv, etc...
+ *
+ * Since pkgcache commits are immutable, the metarpms are kept in a persistent directory
+ * next to the solv cache, named by commit checksum.  That way, each header is extracted
+ * once, rather than on every transaction, and on a hit we don't even need to load the
+ * commit object; all we need is the ref listing.
  */
 static gboolean
 add_remaining_pkgcache_pkgs (RpmOstreeContext *self,
@@ -1660,25 +1931,51 @@ add_remaining_pkgcache_pkgs (RpmOstreeContext *self,
                                   OSTREE_REPO_LIST_REFS_EXT_NONE, cancellable, error))
     return FALSE;
 
-  GLNX_HASH_TABLE_FOREACH (refs, const char*, ref)
+  g_autofree char *hdrcache_path =
+    g_build_filename (dnf_context_get_solv_dir (self->dnfctx),
+                      RPMOSTREE_DIR_CACHE_PKGCACHE_HEADERS, NULL);
+  if (!glnx_shutil_mkdir_p_at (AT_FDCWD, hdrcache_path, 0755, cancellable, error))
+    return FALSE;
+  glnx_autofd int hdrcache_dfd = -1;
+  if (!glnx_opendirat (AT_FDCWD, hdrcache_path, TRUE, &hdrcache_dfd, error))
+    return FALSE;
+
+  g_autoptr(GHashTable) live_names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  GLNX_HASH_TABLE_FOREACH_KV (refs, const char*, ref, const char*, rev)
     {
+      /* give it a .rpm extension so we can fool the libdnf stack */
+      g_autofree char *name = g_strconcat (rev, ".rpm", NULL);
+      g_hash_table_add (live_names, g_strdup (name));
+
       g_autofree char *nevra = rpmostree_cache_branch_to_nevra (ref);
       if (g_hash_table_contains (already_added, nevra))
         continue;
 
-      g_autoptr(GVariant) header = NULL;
-      if (!get_header_variant (pkgcache_repo, ref, &header, cancellable, error))
+      if (!glnx_fstatat_allow_noent (hdrcache_dfd, name, NULL, 0, error))
         return FALSE;
+      if (errno == ENOENT)
+        {
+          g_autoptr(GVariant) header = NULL;
+          if (!get_header_variant (pkgcache_repo, ref, &header, cancellable, error))
+            return FALSE;
 
-      if (!checkout_pkg_metadata (self, nevra, header, cancellable, error))
-        return FALSE;
+          if (!glnx_file_replace_contents_at (hdrcache_dfd, name,
+                                              g_variant_get_data (header),
+                                              g_variant_get_size (header),
+                                              GLNX_FILE_REPLACE_NODATASYNC,
+                                              cancellable, error))
+            return FALSE;
+        }
 
-      g_autofree char *rpm = g_strdup_printf ("%s/metarpm/%s.rpm", self->tmpdir.path, nevra);
+      g_autofree char *rpm = g_build_filename (hdrcache_path, name, NULL);
       DnfPackage *pkg = dnf_sack_add_cmdline_package (sack, rpm);
       if (!pkg)
         return glnx_throw (error, "Failed to add local pkg %s to sack", nevra);
     }
 
+  if (!prune_pkgcache_header_cache (hdrcache_dfd, live_names, cancellable, error))
+    return FALSE;
+
   return TRUE;
 }
 
@@ -1787,6 +2084,8 @@ rpmostree_context_prepare (RpmOstreeContext *self,
         return FALSE;
     }
 
+  g_auto(RpmOstreeOutputPhase) phase = rpmostree_output_phase_begin ("depsolve");
+
   if (self->jigdo_pure)
     {
       g_assert_cmpint (g_strv_length (pkgnames), ==, 0);
@@ -2083,6 +2382,7 @@ rpmostree_context_download (RpmOstreeContext *self,
                             GCancellable     *cancellable,
                             GError          **error)
 {
+  g_auto(RpmOstreeOutputPhase) phase = rpmostree_output_phase_begin ("download");
   int n = self->pkgs_to_download->len;
 
   if (n > 0)
@@ -2178,6 +2478,8 @@ rpmostree_context_import_jigdo (RpmOstreeContext *self,
   if (n == 0)
     return TRUE;
 
+  g_auto(RpmOstreeOutputPhase) phase = rpmostree_output_phase_begin ("import");
+
   OstreeRepo *repo = get_pkgcache_repo (self);
   g_return_val_if_fail (repo != NULL, FALSE);
   g_return_val_if_fail (jigdo_pkg_to_xattrs == NULL || self->sepolicy == NULL, FALSE);
@@ -2395,6 +2697,25 @@ get_rpmdb_pkg_header (rpmts rpmdb_ts,
   return headerLink (hdr);
 }
 
+/* Like strcmp(), but sorts '/' before any other character so that a path is
+ * immediately followed by everything underneath it. E.g. plain strcmp() would
+ * put usr/lib-foo between usr/lib and usr/lib/bar. */
+static int
+compare_paths_subtree_order (gconstpointer a,
+                             gconstpointer b)
+{
+  const char *p1 = *((const char**)a);
+  const char *p2 = *((const char**)b);
+  while (*p1 && *p1 == *p2)
+    {
+      p1++;
+      p2++;
+    }
+  const unsigned char c1 = (*p1 == '/') ? 1 : (unsigned char)*p1;
+  const unsigned char c2 = (*p2 == '/') ? 1 : (unsigned char)*p2;
+  return c1 - c2;
+}
+
 static gboolean
 delete_package_from_root (RpmOstreeContext *self,
                           rpmte         pkg,
@@ -2409,7 +2730,7 @@ delete_package_from_root (RpmOstreeContext *self,
   rpmfi fi = rpmteFI (pkg); /* rpmfi owned by rpmte */
 #endif
 
-  g_autoptr(GPtrArray) deleted_dirs = g_ptr_array_new_with_free_func (g_free);
+  g_autoptr(GPtrArray) paths = g_ptr_array_new_with_free_func (g_free);
 
   int i;
   while ((i = rpmfiNext (fi)) >= 0)
@@ -2427,18 +2748,32 @@ delete_package_from_root (RpmOstreeContext *self,
       fn += strspn (fn, "/");
       g_assert (fn[0]);
 
-      g_autofree char *fn_owned = NULL;
       if (g_str_has_prefix (fn, "etc/"))
-        fn = fn_owned = g_strconcat ("usr/", fn, NULL);
-
+        g_ptr_array_add (paths, g_strconcat ("usr/", fn, NULL));
       /* for now, we only remove files from /usr */
-      if (!g_str_has_prefix (fn, "usr/"))
-        continue;
+      else if (g_str_has_prefix (fn, "usr/"))
+        g_ptr_array_add (paths, g_strdup (fn));
+    }
+
+  /* Plan the removal over the sorted paths, so that once we've handled a path,
+   * we can skip its whole subtree without any more syscalls: it's either been
+   * rm -rf'ed, or it didn't exist in the first place.
+   */
+  g_ptr_array_sort (paths, compare_paths_subtree_order);
+
+  const char *handled = NULL;
+  size_t handled_len = 0;
+  for (guint j = 0; j < paths->len; j++)
+    {
+      const char *fn = paths->pdata[j];
 
-      /* avoiding the stat syscall is worth a bit of userspace computation */
-      if (rpmostree_str_has_prefix_in_ptrarray (fn, deleted_dirs))
+      if (handled && strncmp (fn, handled, handled_len) == 0 &&
+          (fn[handled_len] == '/' || fn[handled_len] == '\0'))
         continue;
 
+      handled = fn;
+      handled_len = strlen (fn);
+
       if (!glnx_fstatat_allow_noent (rootfs_dfd, fn, NULL, AT_SYMLINK_NOFOLLOW, error))
         return FALSE;
       if (errno == ENOENT)
@@ -2446,16 +2781,19 @@ delete_package_from_root (RpmOstreeContext *self,
 
       if (!glnx_shutil_rm_rf_at (rootfs_dfd, fn, cancellable, error))
         return FALSE;
-
-      if (S_ISDIR (mode))
-        g_ptr_array_add (deleted_dirs, g_strconcat (fn, "/", NULL));
     }
 
   return TRUE;
 }
 
 /* Given a directory referred to by @dfd and @dirpath, ensure that physical (or
- * reflink'd) copies of all files are done. */
+ * reflink'd) copies of all files are done.
+ *
+ * Note ostree_break_hardlink() already skips files with a single link and tries
+ * a reflink first, so there's little to gain by having librpm write to a fresh
+ * directory instead; that would need a full rebuilddb, which costs more than
+ * the copy it saves.
+ */
 static gboolean
 break_hardlinks_at (int             dfd,
                     const char     *dirpath,
@@ -2676,6 +3014,8 @@ rpmostree_context_relabel (RpmOstreeContext *self,
   if (n == 0)
     return TRUE;
 
+  g_auto(RpmOstreeOutputPhase) phase = rpmostree_output_phase_begin ("relabel");
+
   g_assert (self->sepolicy);
 
   g_return_val_if_fail (ostreerepo != NULL, FALSE);
@@ -3160,6 +3500,8 @@ rpmostree_context_assemble (RpmOstreeContext      *self,
                             GCancellable          *cancellable,
                             GError               **error)
 {
+  g_auto(RpmOstreeOutputPhase) phase = rpmostree_output_phase_begin ("checkout");
+
   /* Synthesize a tmpdir if we weren't provided a base */
   if (self->tmprootfs_dfd == -1)
     {
@@ -3436,6 +3778,8 @@ rpmostree_context_assemble (RpmOstreeContext      *self,
        * this way is that we only need to read the passwd/group files once
        * before applying the overrides, rather than after each %pre.
        */
+      rpmostree_output_phase_end (&phase);
+      phase = rpmostree_output_phase_begin ("scripts");
       rpmostree_output_task_begin ("Running pre scripts");
       guint n_pre_scripts_run = 0;
       for (guint i = 0; i < n_rpmts_elements; i++)
@@ -3561,6 +3905,8 @@ rpmostree_context_assemble (RpmOstreeContext      *self,
 
   g_clear_pointer (&ordering_ts, rpmtsFree);
 
+  rpmostree_output_phase_end (&phase);
+  phase = rpmostree_output_phase_begin ("rpmdb");
   rpmostree_output_task_begin ("Writing rpmdb");
 
   if (!glnx_shutil_mkdir_p_at (tmprootfs_dfd, RPMOSTREE_RPMDB_LOCATION, 0755, cancellable, error))
@@ -3656,6 +4002,7 @@ rpmostree_context_commit (RpmOstreeContext      *self,
   g_autoptr(OstreeRepoCommitModifier) commit_modifier = NULL;
   g_autofree char *ret_commit_checksum = NULL;
 
+  g_auto(RpmOstreeOutputPhase) phase = rpmostree_output_phase_begin ("commit");
   rpmostree_output_task_begin ("Writing OSTree commit");
 
   g_auto(RpmOstreeRepoAutoTransaction) txn = { 0, };
@@ -3723,10 +4070,13 @@ rpmostree_context_commit (RpmOstreeContext      *self,
                                g_variant_builder_end (&replaced_base_pkgs));
 
         /* this is used by the db commands, and auto updates to diff against the base */
-        g_autoptr(GVariant) rpmdb = NULL;
-        if (!rpmostree_create_rpmdb_pkglist_variant (self->tmprootfs_dfd, &rpmdb,
-                                                     cancellable, error))
-          return FALSE;
+        g_autoptr(GVariant) rpmdb = rpmostree_context_get_rpmdb_pkglist (self);
+        if (!rpmdb)
+          {
+            if (!rpmostree_create_rpmdb_pkglist_variant (self->tmprootfs_dfd, &rpmdb,
+                                                         cancellable, error))
+              return FALSE;
+          }
         g_variant_builder_add (&metadata_builder, "{sv}", "rpmostree.rpmdb.pkglist", rpmdb);
 
         /* be nice to our future selves */
@@ -60,6 +60,8 @@ GHashTable *rpmostree_dnfcontext_get_varsubsts (DnfContext *context);
 
 GVariant *rpmostree_context_get_rpmmd_repo_commit_metadata (RpmOstreeContext  *self);
 
+GVariant *rpmostree_context_get_rpmdb_pkglist (RpmOstreeContext  *self);
+
 GVariant *rpmostree_treespec_to_variant (RpmOstreeTreespec *spec);
 const char *rpmostree_treespec_get_ref (RpmOstreeTreespec *spec);
 
@@ -50,6 +50,15 @@
 
 typedef GObjectClass RpmOstreeImporterClass;
 
+/* What we need to know about a file from the header beyond the CPIO data;
+ * stored along with its rpmfi index in rpmfi_overrides. */
+typedef enum {
+  RPMFI_OVERRIDE_OWNER = (1 << 0), /* non-root user or group */
+  RPMFI_OVERRIDE_FCAPS = (1 << 1), /* has file capabilities */
+  RPMFI_OVERRIDE_DOC   = (1 << 2), /* doc file, and we're filtering docs */
+} RpmfiOverrideFlags;
+#define RPMFI_OVERRIDE_FLAGS_BITS 3
+
 struct RpmOstreeImporter
 {
   GObject parent_instance;
@@ -60,8 +69,9 @@ struct RpmOstreeImporter
   Header hdr;
   rpmfi fi;
   off_t cpio_offset;
-  GHashTable *rpmfi_overrides;
-  GHashTable *doc_files;
+  GHashTable *rpmfi_overrides; /* path --> (fi index << FLAGS_BITS | RpmfiOverrideFlags) */
+  gboolean have_fcaps;
+  gboolean docs_are_filtered;
   GString *tmpfiles_d;
   RpmOstreeImporterFlags flags;
   gboolean unpacking_as_nonroot;
@@ -97,7 +107,6 @@ rpmostree_importer_finalize (GObject *object)
   g_clear_object (&self->sepolicy);
 
   g_clear_pointer (&self->rpmfi_overrides, (GDestroyNotify)g_hash_table_unref);
-  g_clear_pointer (&self->doc_files, (GDestroyNotify)g_hash_table_unref);
 
   g_free (self->hdr_sha256);
 
@@ -204,29 +213,37 @@ build_rpmfi_overrides (RpmOstreeImporter *self)
    * possibly filesystem capabilities from the header.
    *
    * Otherwise we can just use the CPIO data.  Though for handling
-   * NODOCS, we gather a hashset of the files with doc flags.
+   * NODOCS, we also flag the files with doc flags.
+   *
+   * Only files which need something are added; for most packages that's
+   * nothing at all, and the callbacks skip the lookup entirely.
    */
-  const gboolean docs_are_filtered = self->doc_files != NULL;
   while ((i = rpmfiNext (self->fi)) >= 0)
     {
       const char *user = rpmfiFUser (self->fi);
       const char *group = rpmfiFGroup (self->fi);
       const char *fcaps = rpmfiFCaps (self->fi);
-      const char *fn = rpmfiFN (self->fi);
       rpmfileAttrs fattrs = rpmfiFFlags (self->fi);
 
       const gboolean user_is_root = (user == NULL || g_str_equal (user, "root"));
       const gboolean group_is_root = (group == NULL || g_str_equal (group, "root"));
       const gboolean fcaps_is_unset = (fcaps == NULL || fcaps[0] == '\0');
-      if (!(user_is_root && group_is_root && fcaps_is_unset))
-        {
-          g_hash_table_insert (self->rpmfi_overrides, g_strdup (fn),
-                               GINT_TO_POINTER (i));
-        }
-
       const gboolean is_doc = (fattrs & RPMFILE_DOC) > 0;
-      if (docs_are_filtered && is_doc)
-        g_hash_table_add (self->doc_files, g_strdup (fn));
+
+      guint flags = 0;
+      if (!(user_is_root && group_is_root))
+        flags |= RPMFI_OVERRIDE_OWNER;
+      if (!fcaps_is_unset)
+        flags |= RPMFI_OVERRIDE_FCAPS;
+      if (self->docs_are_filtered && is_doc)
+        flags |= RPMFI_OVERRIDE_DOC;
+      if (flags == 0)
+        continue;
+
+      if (flags & RPMFI_OVERRIDE_FCAPS)
+        self->have_fcaps = TRUE;
+      g_hash_table_insert (self->rpmfi_overrides, g_strdup (rpmfiFN (self->fi)),
+                           GUINT_TO_POINTER (((guint)i << RPMFI_OVERRIDE_FLAGS_BITS) | flags));
     }
 }
 
@@ -276,9 +293,7 @@ rpmostree_importer_new_take_fd (int                     *fd,
   ret->cpio_offset = cpio_offset;
   ret->pkg = pkg ? g_object_ref (pkg) : NULL;
 
-  if (flags & RPMOSTREE_IMPORTER_FLAGS_NODOCS)
-    ret->doc_files = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                            g_free, NULL);
+  ret->docs_are_filtered = (flags & RPMOSTREE_IMPORTER_FLAGS_NODOCS) > 0;
   build_rpmfi_overrides (ret);
 
  out:
@@ -299,28 +314,38 @@ rpmostree_importer_set_jigdo_mode (RpmOstreeImporter                    *self,
   self->jigdo_xattrs = g_variant_ref (xattrs);
 }
 
-static void
+/* Returns the RpmfiOverrideFlags of @path, and fills in the owner and fcaps
+ * from the header if it has any. */
+static guint
 get_rpmfi_override (RpmOstreeImporter *self,
                     const char        *path,
                     const char       **out_user,
                     const char       **out_group,
                     const char       **out_fcaps)
 {
-  gpointer v;
+  if (g_hash_table_size (self->rpmfi_overrides) == 0)
+    return 0;
 
-  /* Note: we use extended here because the value might be index 0 */
-  if (!g_hash_table_lookup_extended (self->rpmfi_overrides, path, NULL, &v))
-    return;
+  /* Values are never 0 since we only store files with flags */
+  guint v = GPOINTER_TO_UINT (g_hash_table_lookup (self->rpmfi_overrides, path));
+  if (v == 0)
+    return 0;
 
-  rpmfiInit (self->fi, GPOINTER_TO_INT (v));
-  g_assert (rpmfiNext (self->fi) >= 0);
+  const guint flags = v & ((1 << RPMFI_OVERRIDE_FLAGS_BITS) - 1);
+  if (flags & (RPMFI_OVERRIDE_OWNER | RPMFI_OVERRIDE_FCAPS))
+    {
+      rpmfiInit (self->fi, v >> RPMFI_OVERRIDE_FLAGS_BITS);
+      g_assert (rpmfiNext (self->fi) >= 0);
+
+      if (out_user)
+        *out_user = rpmfiFUser (self->fi);
+      if (out_group)
+        *out_group = rpmfiFGroup (self->fi);
+      if (out_fcaps)
+        *out_fcaps = rpmfiFCaps (self->fi);
+    }
 
-  if (out_user)
-    *out_user = rpmfiFUser (self->fi);
-  if (out_group)
-    *out_group = rpmfiFGroup (self->fi);
-  if (out_fcaps)
-    *out_fcaps = rpmfiFCaps (self->fi);
+  return flags;
 }
 
 const char *
@@ -487,7 +512,7 @@ build_metadata_variant (RpmOstreeImporter *self,
 
     }
 
-  if (self->doc_files)
+  if (self->docs_are_filtered)
     {
       g_variant_builder_add (&metadata_builder, "{sv}",
                              "rpmostree.nodocs",
@@ -601,13 +626,13 @@ compose_filter_cb (OstreeRepo         *repo,
 
   gboolean error_was_set = (error && *error != NULL);
 
+  /* Lookup any rpmfi overrides (was parsed from the header) */
+  const guint override_flags = get_rpmfi_override (self, path, &user, &group, NULL);
+
   /* Are we filtering out docs?  Let's check that first */
-  if (self->doc_files && g_hash_table_contains (self->doc_files, path))
+  if (override_flags & RPMFI_OVERRIDE_DOC)
     return OSTREE_REPO_COMMIT_FILTER_SKIP;
 
-  /* Lookup any rpmfi overrides (was parsed from the header) */
-  get_rpmfi_override (self, path, &user, &group, NULL);
-
   if (self->unpacking_as_nonroot)
     {
       /* In the unprivileged case, libarchive returns our own uid by default.
@@ -671,7 +696,8 @@ unprivileged_filter_cb (OstreeRepo         *repo,
 {
   RpmOstreeImporter *self = ((cb_data*)user_data)->self;
   /* Are we filtering out docs?  Let's check that first */
-  if (self->doc_files && g_hash_table_contains (self->doc_files, path))
+  if (self->docs_are_filtered &&
+      (get_rpmfi_override (self, path, NULL, NULL, NULL) & RPMFI_OVERRIDE_DOC))
     return OSTREE_REPO_COMMIT_FILTER_SKIP;
 
   /* First, the common directory workaround */
@@ -745,6 +771,10 @@ xattr_cb (OstreeRepo  *repo,
   RpmOstreeImporter *self = user_data;
   const char *fcaps = NULL;
 
+  /* This is called for every entry; most packages don't have any fcaps */
+  if (!self->have_fcaps)
+    return NULL;
+
   get_rpmfi_override (self, path, NULL, NULL, &fcaps);
 
   if (fcaps != NULL && fcaps[0] != '\0')
@@ -38,6 +38,15 @@
 #include <string.h>
 #include <stdlib.h>
 
+/* Objects up to this size are read into memory and written asynchronously
+ * (i.e. on the GIO worker pool); anything bigger is streamed directly from the
+ * archive.
+ */
+#define ASYNC_OBJECT_MAX_SIZE (1024 * 1024)
+/* Upper bound on in-flight async writes, in number and in buffered bytes */
+#define ASYNC_MAX_RUNNING 32
+#define ASYNC_MAX_BYTES (32 * 1024 * 1024)
+
 typedef enum {
   STATE_COMMIT,
   STATE_DIRMETA,
@@ -69,6 +78,11 @@ struct RpmOstreeJigdoAssembler
   struct archive *archive;
   struct archive_entry *next_entry;
   int fd;
+
+  /* State for async object writes */
+  guint n_async_running;
+  guint64 async_bytes_running;
+  GError *async_error;
 };
 
 G_DEFINE_TYPE(RpmOstreeJigdoAssembler, rpmostree_jigdo_assembler, G_TYPE_OBJECT)
@@ -85,6 +99,7 @@ rpmostree_jigdo_assembler_finalize (GObject *object)
   g_clear_object (&self->pkg);
   g_clear_pointer (&self->xattrs_table, (GDestroyNotify)g_variant_unref);
   glnx_close_fd (&self->fd);
+  g_clear_error (&self->async_error);
 
   G_OBJECT_CLASS (rpmostree_jigdo_assembler_parent_class)->finalize (object);
 }
@@ -132,6 +147,30 @@ rpmostree_jigdo_assembler_new_take_fd (int *fd,
   return g_steal_pointer (&ret);
 }
 
+/* Read the full contents of @entry into memory */
+static GBytes *
+jigdo_read_bytes (struct archive       *a,
+                  struct archive_entry *entry,
+                  GError              **error)
+{
+  const struct stat *stbuf = archive_entry_stat (entry);
+  g_assert_cmpint (stbuf->st_size, >=, 0);
+  const size_t total = stbuf->st_size;
+  g_autofree guint8* buf = g_malloc (total);
+  size_t bytes_read = 0;
+  while (bytes_read < total)
+    {
+      ssize_t r = archive_read_data (a, buf + bytes_read, total - bytes_read);
+      if (r < 0)
+        return throw_libarchive_error (error, a), NULL;
+      if (r == 0)
+        break;
+      bytes_read += r;
+    }
+  g_assert_cmpint (bytes_read, ==, total);
+  return g_bytes_new_take (g_steal_pointer (&buf), total);
+}
+
 static GVariant *
 jigdo_read_variant (const GVariantType   *vtype,
                     struct archive       *a,
@@ -149,24 +188,10 @@ jigdo_read_variant (const GVariantType   *vtype,
       g_autofree char *found_formatted = g_format_size (stbuf->st_size);
       return glnx_null_throw (error, "Exceeded maximum size %s; %s is of size: %s", max_formatted, found_formatted, path);
     }
-  g_assert_cmpint (stbuf->st_size, >=, 0);
-  const size_t total = stbuf->st_size;
-  g_autofree guint8* buf = g_malloc (total);
-  size_t bytes_read = 0;
-  while (bytes_read < total)
-    {
-      ssize_t r = archive_read_data (a, buf + bytes_read, total - bytes_read);
-      if (r < 0)
-        return throw_libarchive_error (error, a), NULL;
-      if (r == 0)
-        break;
-      bytes_read += r;
-    }
-  g_assert_cmpint (bytes_read, ==, total)
-;
-  /* Need to take ownership once now, then pass it as a parameter twice */
-  guint8* buf_owned = g_steal_pointer (&buf);
-  return g_variant_new_from_data (vtype, buf_owned, bytes_read, FALSE, g_free, buf_owned);
+  g_autoptr(GBytes) bytes = jigdo_read_bytes (a, entry, error);
+  if (!bytes)
+    return NULL;
+  return g_variant_new_from_bytes (vtype, bytes, FALSE);
 }
 
 /* Remove leading prefix */
@@ -359,55 +384,80 @@ process_contentident (RpmOstreeJigdoAssembler    *self,
     return glnx_throw (error, "Malformed contentident: %s", content_pathname);
 
   const struct stat *stbuf = archive_entry_stat (entry);
-
-  /* Copy the data to a temporary file; a better optimization would be to write
-   * the data to the first object, then clone it, but that requires some
-   * more libostree API.  As far as I can see, one can't reliably seek with
-   * libarchive; only some formats support it, and cpio isn't one of them.
-   */
-  g_auto(GLnxTmpfile) tmpf = { 0, };
-  if (!glnx_open_anonymous_tmpfile (O_RDWR | O_CLOEXEC, &tmpf, error))
-    return FALSE;
-
   const size_t total = stbuf->st_size;
-  const size_t bufsize = MIN (128*1024, total);
-  g_autofree guint8* buf = g_malloc (bufsize);
-  size_t bytes_read = 0;
-  while (bytes_read < total)
-    {
-      ssize_t r = archive_read_data (self->archive, buf, MIN (bufsize, total - bytes_read));
-      if (r < 0)
-        return throw_libarchive_error (error, self->archive);
-      if (r == 0)
-        break;
-      if (glnx_loop_write (tmpf.fd, buf, r) < 0)
-        return glnx_throw_errno_prefix (error, "write");
-      bytes_read += r;
-    }
-  g_assert_cmpint (bytes_read, ==, total);
-  g_clear_pointer (&buf, g_free);
 
+  /* Figure out which of the objects we actually need to write before touching
+   * the content; in the common case of an upgrade we'll already have some (or
+   * all) of them, and we want to avoid copying the data at all if we can.
+   */
   const guint n = g_variant_n_children (meta);
+  g_autoptr(GArray) missing = g_array_new (FALSE, FALSE, sizeof (guint));
   for (guint i = 0; i < n; i++)
     {
       const char *checksum;
-      guint32 uid,gid,mode;
-      g_autoptr(GVariant) xattrs = NULL;
-      g_variant_get_child (meta, i, "(&suuu@a(ayay))", &checksum, &uid, &gid, &mode, &xattrs);
-      /* See if we already have this object */
+      g_variant_get_child (meta, i, "(&suuu@a(ayay))", &checksum, NULL, NULL, NULL, NULL);
       gboolean has_object;
       if (!ostree_repo_has_object (repo, OSTREE_OBJECT_TYPE_FILE, checksum,
                                    &has_object, cancellable, error))
         return FALSE;
-      if (has_object)
-        continue;
+      if (!has_object)
+        g_array_append_val (missing, i);
+    }
+
+  /* Nothing to do; libarchive will skip the data on the next header read */
+  if (missing->len == 0)
+    return TRUE;
+
+  /* If there's more than one object to write, copy the data to a temporary
+   * file; a better optimization would be to write the data to the first
+   * object, then clone it, but that requires some more libostree API.  As far
+   * as I can see, one can't reliably seek with libarchive; only some formats
+   * support it, and cpio isn't one of them.  If there's just one, we can stream
+   * directly from the archive.
+   */
+  g_auto(GLnxTmpfile) tmpf = { 0, };
+  if (missing->len > 1)
+    {
+      if (!glnx_open_anonymous_tmpfile (O_RDWR | O_CLOEXEC, &tmpf, error))
+        return FALSE;
+
+      const size_t bufsize = MIN (128*1024, total);
+      g_autofree guint8* buf = g_malloc (bufsize);
+      size_t bytes_read = 0;
+      while (bytes_read < total)
+        {
+          ssize_t r = archive_read_data (self->archive, buf, MIN (bufsize, total - bytes_read));
+          if (r < 0)
+            return throw_libarchive_error (error, self->archive);
+          if (r == 0)
+            break;
+          if (glnx_loop_write (tmpf.fd, buf, r) < 0)
+            return glnx_throw_errno_prefix (error, "write");
+          bytes_read += r;
+        }
+      g_assert_cmpint (bytes_read, ==, total);
+    }
+
+  for (guint i = 0; i < missing->len; i++)
+    {
+      const char *checksum;
+      guint32 uid,gid,mode;
+      g_autoptr(GVariant) xattrs = NULL;
+      g_variant_get_child (meta, g_array_index (missing, guint, i),
+                           "(&suuu@a(ayay))", &checksum, &uid, &gid, &mode, &xattrs);
       uid = GUINT32_FROM_BE (uid);
       gid = GUINT32_FROM_BE (gid);
       mode = GUINT32_FROM_BE (mode);
 
-      if (lseek (tmpf.fd, 0, SEEK_SET) < 0)
-        return glnx_throw_errno_prefix (error, "lseek");
-      g_autoptr(GInputStream) istream = g_unix_input_stream_new (tmpf.fd, FALSE);
+      g_autoptr(GInputStream) istream = NULL;
+      if (tmpf.initialized)
+        {
+          if (lseek (tmpf.fd, 0, SEEK_SET) < 0)
+            return glnx_throw_errno_prefix (error, "lseek");
+          istream = g_unix_input_stream_new (tmpf.fd, FALSE);
+        }
+      else
+        istream = _rpm_ostree_libarchive_input_stream_new (self->archive);
       /* Like _ostree_stbuf_to_gfileinfo() - TODO make that public with a
        * better content writing API.
        */
@@ -446,19 +496,132 @@ state_transition (RpmOstreeJigdoAssembler    *self,
   return TRUE;
 }
 
-/* Process new objects included in the OIRPM */
-gboolean
-rpmostree_jigdo_assembler_write_new_objects (RpmOstreeJigdoAssembler    *self,
-                                   OstreeRepo        *repo,
-                                   GCancellable      *cancellable,
-                                   GError           **error)
+typedef struct {
+  RpmOstreeJigdoAssembler *self;
+  gsize size;
+} AsyncWriteData;
+
+static void
+async_write_complete (AsyncWriteData *data,
+                      gboolean        success,
+                      GError         *local_error)
 {
-  GLNX_AUTO_PREFIX_ERROR ("Writing new objects", error);
-  g_assert_cmpint (self->state, ==, STATE_DIRMETA);
+  RpmOstreeJigdoAssembler *self = data->self;
+  if (!success && !self->async_error)
+    self->async_error = g_steal_pointer (&local_error);
+  g_clear_error (&local_error);
+  g_assert_cmpint (self->n_async_running, >, 0);
+  self->n_async_running--;
+  self->async_bytes_running -= data->size;
+  g_object_unref (self);
+  g_free (data);
+}
 
-  /* TODO sort objects in order for importing, verify we're not
-   * importing an unknown object.
-   */
+static void
+on_metadata_written (GObject      *src,
+                     GAsyncResult *res,
+                     gpointer      user_data)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autofree guchar *csum = NULL;
+  gboolean success = ostree_repo_write_metadata_finish ((OstreeRepo*)src, res, &csum, &local_error);
+  async_write_complete (user_data, success, g_steal_pointer (&local_error));
+}
+
+static void
+on_content_written (GObject      *src,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autofree guchar *csum = NULL;
+  gboolean success = ostree_repo_write_content_finish ((OstreeRepo*)src, res, &csum, &local_error);
+  async_write_complete (user_data, success, g_steal_pointer (&local_error));
+}
+
+static AsyncWriteData *
+async_write_begin (RpmOstreeJigdoAssembler *self,
+                   gsize                    size)
+{
+  AsyncWriteData *data = g_new0 (AsyncWriteData, 1);
+  data->self = g_object_ref (self);
+  data->size = size;
+  self->n_async_running++;
+  self->async_bytes_running += size;
+  return data;
+}
+
+/* Block until there are at most @max_running async writes in flight, and at
+ * most @max_bytes bytes of buffered payload.
+ */
+static gboolean
+wait_for_async_writes (RpmOstreeJigdoAssembler *self,
+                       guint                    max_running,
+                       guint64                  max_bytes,
+                       GError                 **error)
+{
+  GMainContext *mainctx = g_main_context_get_thread_default ();
+  while (self->n_async_running > max_running ||
+         self->async_bytes_running > max_bytes)
+    g_main_context_iteration (mainctx, TRUE);
+  if (self->async_error)
+    {
+      g_propagate_error (error, g_steal_pointer (&self->async_error));
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/* Wait until there's room for one more async write of @size bytes */
+static gboolean
+wait_for_async_write_slot (RpmOstreeJigdoAssembler *self,
+                           gsize                    size,
+                           GError                 **error)
+{
+  /* An oversized write just waits for everything else to finish */
+  const guint64 max_bytes = size < ASYNC_MAX_BYTES ? ASYNC_MAX_BYTES - size : 0;
+  return wait_for_async_writes (self, ASYNC_MAX_RUNNING - 1, max_bytes, error);
+}
+
+/* On error, we still need to wait for any writes in flight before returning,
+ * since they reference @self and the caller will likely abort the transaction.
+ */
+static void
+drain_async_writes (RpmOstreeJigdoAssembler *self)
+{
+  GMainContext *mainctx = g_main_context_get_thread_default ();
+  while (self->n_async_running > 0)
+    g_main_context_iteration (mainctx, TRUE);
+  g_clear_error (&self->async_error);
+}
+
+static gboolean
+write_metadata_async (RpmOstreeJigdoAssembler *self,
+                      OstreeRepo              *repo,
+                      OstreeObjectType         objtype,
+                      const char              *checksum,
+                      GVariant                *variant,
+                      GCancellable            *cancellable,
+                      GError                 **error)
+{
+  const gsize size = g_variant_get_size (variant);
+  if (!wait_for_async_write_slot (self, size, error))
+    return FALSE;
+  ostree_repo_write_metadata_async (repo, objtype, checksum, variant, cancellable,
+                                    on_metadata_written, async_write_begin (self, size));
+  return TRUE;
+}
+
+/* Helper for rpmostree_jigdo_assembler_write_new_objects(); this may return
+ * with async writes still in flight.
+ */
+static gboolean
+write_new_objects_impl (RpmOstreeJigdoAssembler    *self,
+                        OstreeRepo                 *repo,
+                        GCancellable               *cancellable,
+                        GError                    **error)
+{
+  /* TODO verify we're not importing an unknown object. */
   while (TRUE)
     {
       gboolean eof;
@@ -481,9 +644,10 @@ rpmostree_jigdo_assembler_write_new_objects (RpmOstreeJigdoAssembler    *self,
           g_autoptr(GVariant) dirmeta = jigdo_read_variant (OSTREE_DIRMETA_GVARIANT_FORMAT,
                                                             self->archive, entry,
                                                             cancellable, error);
-          g_autofree guint8*csum = NULL;
-          if (!ostree_repo_write_metadata (repo, OSTREE_OBJECT_TYPE_DIR_META,
-                                           checksum, dirmeta, &csum, cancellable, error))
+          if (!dirmeta)
+            return FALSE;
+          if (!write_metadata_async (self, repo, OSTREE_OBJECT_TYPE_DIR_META, checksum,
+                                     dirmeta, cancellable, error))
             return FALSE;
         }
       else if (g_str_has_prefix (pathname, RPMOSTREE_JIGDO_DIRTREE_DIR "/"))
@@ -497,9 +661,10 @@ rpmostree_jigdo_assembler_write_new_objects (RpmOstreeJigdoAssembler    *self,
           g_autoptr(GVariant) dirtree = jigdo_read_variant (OSTREE_TREE_GVARIANT_FORMAT,
                                                             self->archive, entry,
                                                             cancellable, error);
-          g_autofree guint8*csum = NULL;
-          if (!ostree_repo_write_metadata (repo, OSTREE_OBJECT_TYPE_DIR_TREE,
-                                           checksum, dirtree, &csum, cancellable, error))
+          if (!dirtree)
+            return FALSE;
+          if (!write_metadata_async (self, repo, OSTREE_OBJECT_TYPE_DIR_TREE, checksum,
+                                     dirtree, cancellable, error))
             return FALSE;
         }
       else if (g_str_has_prefix (pathname, RPMOSTREE_JIGDO_NEW_CONTENTIDENT_DIR "/"))
@@ -521,11 +686,26 @@ rpmostree_jigdo_assembler_write_new_objects (RpmOstreeJigdoAssembler    *self,
           const struct stat *stbuf = archive_entry_stat (entry);
           g_assert_cmpint (stbuf->st_size, >=, 0);
 
-          g_autoptr(GInputStream) archive_stream = _rpm_ostree_libarchive_input_stream_new (self->archive);
-          g_autofree guint8*csum = NULL;
-          if (!ostree_repo_write_content (repo, checksum, archive_stream,
-                                          stbuf->st_size, &csum, cancellable, error))
-            return FALSE;
+          if (stbuf->st_size <= ASYNC_OBJECT_MAX_SIZE)
+            {
+              if (!wait_for_async_write_slot (self, stbuf->st_size, error))
+                return FALSE;
+              g_autoptr(GBytes) bytes = jigdo_read_bytes (self->archive, entry, error);
+              if (!bytes)
+                return FALSE;
+              g_autoptr(GInputStream) memstream = g_memory_input_stream_new_from_bytes (bytes);
+              ostree_repo_write_content_async (repo, checksum, memstream, stbuf->st_size,
+                                               cancellable, on_content_written,
+                                               async_write_begin (self, stbuf->st_size));
+            }
+          else
+            {
+              g_autoptr(GInputStream) archive_stream = _rpm_ostree_libarchive_input_stream_new (self->archive);
+              g_autofree guint8*csum = NULL;
+              if (!ostree_repo_write_content (repo, checksum, archive_stream,
+                                              stbuf->st_size, &csum, cancellable, error))
+                return FALSE;
+            }
         }
       else if (g_str_has_prefix (pathname, RPMOSTREE_JIGDO_XATTRS_DIR "/"))
         {
@@ -539,6 +719,36 @@ rpmostree_jigdo_assembler_write_new_objects (RpmOstreeJigdoAssembler    *self,
   return TRUE;
 }
 
+/* Process new objects included in the OIRPM.  The archive is ordered by
+ * object type (see rpmostree-jigdo-core.h); within that, metadata and small
+ * content objects are buffered and handed off to the GIO worker pool, while
+ * large content objects are streamed directly from the archive.
+ */
+gboolean
+rpmostree_jigdo_assembler_write_new_objects (RpmOstreeJigdoAssembler    *self,
+                                   OstreeRepo        *repo,
+                                   GCancellable      *cancellable,
+                                   GError           **error)
+{
+  GLNX_AUTO_PREFIX_ERROR ("Writing new objects", error);
+  g_assert_cmpint (self->state, ==, STATE_DIRMETA);
+
+  if (!write_new_objects_impl (self, repo, cancellable, error))
+    {
+      drain_async_writes (self);
+      return FALSE;
+    }
+
+  /* Wait for everything to land */
+  if (!wait_for_async_writes (self, 0, 0, error))
+    {
+      drain_async_writes (self);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
 GVariant *
 rpmostree_jigdo_assembler_get_xattr_table (RpmOstreeJigdoAssembler    *self)
 {
@@ -66,13 +66,186 @@ compare_pkgs (gconstpointer ap,
   return dnf_package_cmp (*a, *b);
 }
 
+/* Values in the object presence maps below; we need to distinguish "missing"
+ * from "not in the tree at all".
+ */
+#define OBJ_MISSING GUINT_TO_POINTER (1)
+#define OBJ_PRESENT GUINT_TO_POINTER (2)
+
+static void
+record_presence (GHashTable *map,
+                 const char *key,
+                 gboolean    present)
+{
+  /* For basenames, a single missing object poisons the whole objid */
+  if (g_hash_table_lookup (map, key) == OBJ_MISSING)
+    return;
+  g_hash_table_replace (map, g_strdup (key), present ? OBJ_PRESENT : OBJ_MISSING);
+}
+
+/* Walk a dirtree of the target commit, recording whether each content object
+ * is already in @repo; keyed both by full path and by basename, since those
+ * are the two forms of "objid" the jigdoRPM uses.
+ */
+static gboolean
+build_object_presence_recurse (OstreeRepo                   *repo,
+                               OstreeRepoCommitTraverseIter *iter,
+                               GString                      *path,
+                               GHashTable                   *path_to_presence,
+                               GHashTable                   *bn_to_presence,
+                               GCancellable                 *cancellable,
+                               GError                      **error)
+{
+  const gsize base_len = path->len;
+  while (TRUE)
+    {
+      OstreeRepoCommitIterResult iterres =
+        ostree_repo_commit_traverse_iter_next (iter, cancellable, error);
+
+      switch (iterres)
+        {
+        case OSTREE_REPO_COMMIT_ITER_RESULT_ERROR:
+          return FALSE;
+        case OSTREE_REPO_COMMIT_ITER_RESULT_END:
+          return TRUE;
+        case OSTREE_REPO_COMMIT_ITER_RESULT_FILE:
+          {
+            char *name;
+            char *checksum;
+            ostree_repo_commit_traverse_iter_get_file (iter, &name, &checksum);
+
+            gboolean has_object;
+            if (!ostree_repo_has_object (repo, OSTREE_OBJECT_TYPE_FILE, checksum,
+                                         &has_object, cancellable, error))
+              return FALSE;
+
+            g_string_append_c (path, '/');
+            g_string_append (path, name);
+            record_presence (path_to_presence, path->str, has_object);
+            record_presence (bn_to_presence, name, has_object);
+            g_string_truncate (path, base_len);
+          }
+          break;
+        case OSTREE_REPO_COMMIT_ITER_RESULT_DIR:
+          {
+            char *name;
+            char *content_checksum;
+            char *meta_checksum;
+            g_autoptr(GVariant) dirtree = NULL;
+            ostree_cleanup_repo_commit_traverse_iter
+              OstreeRepoCommitTraverseIter subiter = { 0, };
+
+            ostree_repo_commit_traverse_iter_get_dir (iter, &name, &content_checksum, &meta_checksum);
+
+            if (!ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_DIR_TREE,
+                                           content_checksum, &dirtree, error))
+              return FALSE;
+
+            if (!ostree_repo_commit_traverse_iter_init_dirtree (&subiter, repo, dirtree,
+                                                                OSTREE_REPO_COMMIT_TRAVERSE_FLAG_NONE,
+                                                                error))
+              return FALSE;
+
+            g_string_append_c (path, '/');
+            g_string_append (path, name);
+            if (!build_object_presence_recurse (repo, &subiter, path, path_to_presence,
+                                                bn_to_presence, cancellable, error))
+              return FALSE;
+            g_string_truncate (path, base_len);
+          }
+          break;
+        }
+    }
+}
+
+/* Return TRUE if every object in @objid_to_xattrs (the per-package objid map
+ * from the jigdoRPM) is already present in the repo.
+ */
+static gboolean
+pkg_objects_all_present (GVariant   *objid_to_xattrs,
+                         GHashTable *path_to_presence,
+                         GHashTable *bn_to_presence)
+{
+  const guint n = g_variant_n_children (objid_to_xattrs);
+  for (guint i = 0; i < n; i++)
+    {
+      const char *objid;
+      g_variant_get_child (objid_to_xattrs, i, "(&su)", &objid, NULL);
+      GHashTable *map = (*objid == '/') ? path_to_presence : bn_to_presence;
+      if (g_hash_table_lookup (map, objid) != OBJ_PRESENT)
+        return FALSE;
+    }
+  return TRUE;
+}
+
+/* Gather the NEVRAs of the packages in the commits @repo already has refs to,
+ * according to their rpmostree.rpmdb.pkglist metadata. We skip our own
+ * rpmostree/ refs (notably the pkgcache ones, of which there may be many);
+ * those aren't full trees.
+ */
+static gboolean
+get_nevras_in_repo (OstreeRepo    *repo,
+                    GHashTable   **out_nevras,
+                    GCancellable  *cancellable,
+                    GError       **error)
+{
+  g_autoptr(GHashTable) refs = NULL;
+  if (!ostree_repo_list_refs (repo, NULL, &refs, cancellable, error))
+    return FALSE;
+
+  g_autoptr(GHashTable) nevras = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_autoptr(GHashTable) seen_commits = g_hash_table_new (g_str_hash, g_str_equal);
+  GLNX_HASH_TABLE_FOREACH_KV (refs, const char*, ref, const char*, rev)
+    {
+      if (g_str_has_prefix (ref, "rpmostree/"))
+        continue;
+      if (g_hash_table_contains (seen_commits, rev))
+        continue;
+      g_hash_table_add (seen_commits, (char*)rev);
+
+      g_autoptr(GVariant) commit = NULL;
+      OstreeRepoCommitState commitstate;
+      if (!ostree_repo_load_commit (repo, rev, &commit, &commitstate, error))
+        return FALSE;
+      if (commitstate & OSTREE_REPO_COMMIT_STATE_PARTIAL)
+        continue;
+
+      g_autoptr(GVariant) meta = g_variant_get_child_value (commit, 0);
+      g_autoptr(GVariantDict) meta_dict = g_variant_dict_new (meta);
+      g_autoptr(GVariant) pkglist =
+        g_variant_dict_lookup_value (meta_dict, "rpmostree.rpmdb.pkglist",
+                                     G_VARIANT_TYPE ("a(stsss)"));
+      if (!pkglist)
+        continue;
+
+      const guint n = g_variant_n_children (pkglist);
+      for (guint i = 0; i < n; i++)
+        {
+          const char *name, *version, *release, *arch;
+          guint64 epoch;
+          g_variant_get_child (pkglist, i, "(&st&s&s&s)", &name, &epoch,
+                               &version, &release, &arch);
+          g_hash_table_add (nevras,
+                            rpmostree_custom_nevra_strdup (name, epoch, version, release, arch,
+                                                           PKG_NEVRA_FLAGS_NAME |
+                                                           PKG_NEVRA_FLAGS_EPOCH_VERSION_RELEASE |
+                                                           PKG_NEVRA_FLAGS_ARCH));
+        }
+    }
+
+  *out_nevras = g_steal_pointer (&nevras);
+  return TRUE;
+}
+
 /* Core logic for performing a jigdo assembly client side.  The high level flow is:
  *
  * - Download rpm-md
  * - query for jigdoRPM
  * - query for jigdoSet (dependencies of above)
- * - download and parse jigdoRPM
- * - download and import jigdoSet
+ * - download and parse jigdoRPM (along with the packages from jigdoSet that
+ *   aren't in any commit we already have)
+ * - skip packages from jigdoSet whose objects are all present
+ * - download and import remaining jigdoSet
  * - commit all data to ostree
  */
 gboolean
@@ -146,13 +319,26 @@ rpmostree_context_execute_jigdo (RpmOstreeContext     *self,
 
   rpmostree_output_message ("Jigdo from %u packages", pkgs_required->len);
 
-  /* For now we first serially download the oirpm, but down the line we can do
-   * this async. Doing so will require putting more of the jigdo logic into the
-   * core, so it knows not to import the jigdoRPM.
+  /* We know the jigdo set from the repo metadata already, so there's no reason
+   * to wait for the jigdoRPM to arrive before downloading it; fetch them in
+   * the same batch. The exception is packages whose objects we likely already
+   * have: we can only tell for sure after parsing the objid map from the
+   * jigdoRPM, but if the exact NEVRA is in a commit we have, it's a good bet,
+   * so hold off on those.
    */
-  { g_autoptr(GPtrArray) oirpm_singleton_pkglist = g_ptr_array_new ();
-    g_ptr_array_add (oirpm_singleton_pkglist, oirpm_pkg);
-    if (!rpmostree_context_set_packages (self, oirpm_singleton_pkglist, cancellable, error))
+  { g_autoptr(GHashTable) nevras_in_repo = NULL;
+    if (!get_nevras_in_repo (repo, &nevras_in_repo, cancellable, error))
+      return FALSE;
+
+    g_autoptr(GPtrArray) initial_pkgs = g_ptr_array_new ();
+    g_ptr_array_add (initial_pkgs, oirpm_pkg);
+    for (guint i = 0; i < pkgs_required->len; i++)
+      {
+        DnfPackage *pkg = pkgs_required->pdata[i];
+        if (!g_hash_table_contains (nevras_in_repo, dnf_package_get_nevra (pkg)))
+          g_ptr_array_add (initial_pkgs, pkg);
+      }
+    if (!rpmostree_context_set_packages (self, initial_pkgs, cancellable, error))
       return FALSE;
   }
 
@@ -207,27 +393,40 @@ rpmostree_context_execute_jigdo (RpmOstreeContext     *self,
   if (!rpmostree_context_set_packages (self, pkgs_required, cancellable, error))
     return FALSE;
 
-  /* See what packages we need to import, print their size. TODO clarify between
-   * download/import.
-   */
   g_autoptr(GHashTable) pkgset_to_import = g_hash_table_new (NULL, NULL);
   { g_autoptr(GPtrArray) pkgs_to_import = rpmostree_context_get_packages_to_import (self);
-    guint64 dlsize = 0;
     for (guint i = 0; i < pkgs_to_import->len; i++)
-      {
-        DnfPackage *pkg = pkgs_to_import->pdata[i];
-        dlsize += dnf_package_get_size (pkg);
-        g_hash_table_add (pkgset_to_import, pkg);
-      }
-    g_autofree char *dlsize_fmt = g_format_size (dlsize);
-    rpmostree_output_message ("%u packages to import, download size: %s", pkgs_to_import->len, dlsize_fmt);
+      g_hash_table_add (pkgset_to_import, pkgs_to_import->pdata[i]);
   }
 
-  /* Parse the xattr data in the jigdoRPM */
+  /* Find out which objects of the target commit we already have; the
+   * dirtree/dirmeta objects were written above.
+   */
+  g_autoptr(GHashTable) path_to_presence = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_autoptr(GHashTable) bn_to_presence = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  if (g_hash_table_size (pkgset_to_import) > 0)
+    {
+      ostree_cleanup_repo_commit_traverse_iter
+        OstreeRepoCommitTraverseIter iter = { 0, };
+      if (!ostree_repo_commit_traverse_iter_init_commit (&iter, repo, commit,
+                                                         OSTREE_REPO_COMMIT_TRAVERSE_FLAG_NONE,
+                                                         error))
+        return FALSE;
+      g_autoptr(GString) path = g_string_new ("");
+      if (!build_object_presence_recurse (repo, &iter, path, path_to_presence,
+                                          bn_to_presence, cancellable, error))
+        return FALSE;
+    }
+
+  /* Parse the xattr data in the jigdoRPM, skipping any package whose
+   * objects are all already present in the repo.
+   */
   g_autoptr(GHashTable) pkg_to_xattrs = g_hash_table_new_full (NULL, NULL,
                                                                (GDestroyNotify)g_object_unref,
                                                                (GDestroyNotify)g_variant_unref);
 
+  g_autoptr(GPtrArray) pkgs_needed = g_ptr_array_new ();
+  guint n_skipped = 0;
   for (guint i = 0; i < pkgs_required->len; i++)
     {
       DnfPackage *pkg = pkgs_required->pdata[i];
@@ -238,10 +437,37 @@ rpmostree_context_execute_jigdo (RpmOstreeContext     *self,
       if (!objid_to_xattrs)
         return glnx_throw (error, "missing xattr entry: %s", dnf_package_get_name (pkg));
       if (!should_import)
-        continue;
+        {
+          g_ptr_array_add (pkgs_needed, pkg);
+          continue;
+        }
+      if (pkg_objects_all_present (objid_to_xattrs, path_to_presence, bn_to_presence))
+        {
+          n_skipped++;
+          continue;
+        }
+      g_ptr_array_add (pkgs_needed, pkg);
       g_hash_table_insert (pkg_to_xattrs, g_object_ref (pkg), g_steal_pointer (&objid_to_xattrs));
     }
 
+  if (n_skipped > 0)
+    {
+      if (!rpmostree_context_set_packages (self, pkgs_needed, cancellable, error))
+        return FALSE;
+    }
+
+  /* See what packages we need to import, print their size. TODO clarify between
+   * download/import.
+   */
+  { g_autoptr(GPtrArray) pkgs_to_import = rpmostree_context_get_packages_to_import (self);
+    guint64 dlsize = 0;
+    for (guint i = 0; i < pkgs_to_import->len; i++)
+      dlsize += dnf_package_get_size (pkgs_to_import->pdata[i]);
+    g_autofree char *dlsize_fmt = g_format_size (dlsize);
+    rpmostree_output_message ("%u packages to import (%u already present), download size: %s",
+                              pkgs_to_import->len, n_skipped, dlsize_fmt);
+  }
+
   /* Start the download and import, using the xattr data from the jigdoRPM */
   if (!rpmostree_context_download (self, cancellable, error))
     return FALSE;
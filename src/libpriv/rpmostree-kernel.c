@@ -37,9 +37,16 @@
 #include "rpmostree-kernel.h"
 #include "rpmostree-bwrap.h"
 #include "rpmostree-util.h"
+#include "rpmostree-rpm-util.h"
 
 static const char usrlib_ostreeboot[] = "usr/lib/ostree-boot";
 
+/* Subdirectory of the caller-provided cache directory holding generated
+ * initramfs images, and how many of them we retain.
+ */
+#define RPMOSTREE_DIR_CACHE_INITRAMFS "initramfs"
+#define RPMOSTREE_INITRAMFS_CACHE_MAX 3
+
 /* Keep this in sync with ostree/src/libostree/ostree-sysroot-deploy.c:get_kernel_from_tree().
  * Note they are of necessity slightly different since rpm-ostree needs
  * to support grabbing wherever the Fedora kernel RPM dropped files as well.
@@ -361,12 +368,293 @@ dracut_child_setup (gpointer data)
     err (1, "dup2");
 }
 
+/* Feed the type, name and content of @path (recursively, in sorted order) into
+ * @checksum. Missing paths are recorded as such, so that e.g. adding a
+ * dracut.conf.d snippet changes the result.
+ */
+static gboolean
+checksum_path_recurse (GChecksum    *checksum,
+                       int           dfd,
+                       const char   *path,
+                       GCancellable *cancellable,
+                       GError      **error)
+{
+  struct stat stbuf;
+  if (!glnx_fstatat_allow_noent (dfd, path, &stbuf, AT_SYMLINK_NOFOLLOW, error))
+    return FALSE;
+  const gboolean exists = (errno == 0);
+
+  g_checksum_update (checksum, (guint8*)path, strlen (path) + 1);
+  if (!exists)
+    {
+      g_checksum_update (checksum, (guint8*)"noent", 6);
+      return TRUE;
+    }
+
+  guint32 mode_uid_gid[] = { GUINT32_TO_BE (stbuf.st_mode), GUINT32_TO_BE (stbuf.st_uid),
+                              GUINT32_TO_BE (stbuf.st_gid) };
+  g_checksum_update (checksum, (guint8*)mode_uid_gid, sizeof (mode_uid_gid));
+
+  if (S_ISREG (stbuf.st_mode))
+    return _rpmostree_util_update_checksum_from_file (checksum, dfd, path,
+                                                      cancellable, error);
+  else if (S_ISLNK (stbuf.st_mode))
+    {
+      g_autofree char *target = glnx_readlinkat_malloc (dfd, path, cancellable, error);
+      if (!target)
+        return FALSE;
+      g_checksum_update (checksum, (guint8*)target, strlen (target) + 1);
+      return TRUE;
+    }
+  else if (!S_ISDIR (stbuf.st_mode))
+    return TRUE;
+
+  g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+  if (!glnx_dirfd_iterator_init_at (dfd, path, FALSE, &dfd_iter, error))
+    return FALSE;
+
+  g_autoptr(GPtrArray) names = g_ptr_array_new_with_free_func (g_free);
+  while (TRUE)
+    {
+      struct dirent *dent = NULL;
+      if (!glnx_dirfd_iterator_next_dent (&dfd_iter, &dent, cancellable, error))
+        return FALSE;
+      if (!dent)
+        break;
+      g_ptr_array_add (names, g_strdup (dent->d_name));
+    }
+  g_ptr_array_sort (names, rpmostree_ptrarray_sort_compare_strings);
+
+  for (guint i = 0; i < names->len; i++)
+    {
+      g_autofree char *subpath = g_build_filename (path, names->pdata[i], NULL);
+      if (!checksum_path_recurse (checksum, dfd, subpath, cancellable, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Compute the cache key for a dracut run. This covers everything we know
+ * dracut reads: the kernel version and modules, dracut itself, our wrapper and
+ * arguments, and when rebuilding, the base initramfs. Dracut may copy in any
+ * file from the /etc it sees (modprobe.d, vconsole.conf, crypttab, keyfiles
+ * passed via -I, ...), so we hash all of @etc_path rather than trying to guess
+ * which ones matter; that's either the tree's usr/etc, or the host /etc when
+ * regenerating client side. Dracut also copies binaries and libraries from the
+ * rest of the tree and runs hooks from any package; we capture those via the
+ * installed package set.
+ */
+static char *
+compute_initramfs_cache_key (int                rootfs_dfd,
+                             const char        *wrapper,
+                             const char *const *argv,
+                             const char        *kver,
+                             const char        *etc_path,
+                             const char        *rebuild_from_initramfs,
+                             GCancellable      *cancellable,
+                             GError           **error)
+{
+  g_autoptr(GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA256);
+
+  g_checksum_update (checksum, (guint8*)wrapper, strlen (wrapper) + 1);
+  g_checksum_update (checksum, (guint8*)(kver ?: ""), strlen (kver ?: "") + 1);
+  for (char **iter = (char**)argv; iter && *iter; iter++)
+    g_checksum_update (checksum, (guint8*)*iter, strlen (*iter) + 1);
+
+  g_autofree char *modules_path = kver ? g_strconcat ("usr/lib/modules/", kver, NULL) : NULL;
+  const char *paths[] = { "usr/bin/dracut", "usr/lib/dracut", etc_path, modules_path,
+                          rebuild_from_initramfs };
+  for (guint i = 0; i < G_N_ELEMENTS (paths); i++)
+    {
+      if (paths[i] &&
+          !checksum_path_recurse (checksum, rootfs_dfd, paths[i], cancellable, error))
+        return NULL;
+    }
+
+  g_autoptr(GVariant) pkglist = NULL;
+  if (!rpmostree_create_rpmdb_pkglist_variant (rootfs_dfd, &pkglist, cancellable, error))
+    return NULL;
+  g_checksum_update (checksum, g_variant_get_data (pkglist), g_variant_get_size (pkglist));
+
+  return g_strdup (g_checksum_get_string (checksum));
+}
+
+typedef struct {
+  char *name;
+  time_t mtime;
+} CachedInitramfs;
+
+static void
+cached_initramfs_clear (gpointer data)
+{
+  CachedInitramfs *entry = data;
+  g_free (entry->name);
+}
+
+/* Newest first */
+static int
+compare_cached_initramfs (gconstpointer ap,
+                          gconstpointer bp)
+{
+  const CachedInitramfs *a = ap;
+  const CachedInitramfs *b = bp;
+  if (a->mtime == b->mtime)
+    return 0;
+  return a->mtime > b->mtime ? -1 : 1;
+}
+
+/* Only keep the RPMOSTREE_INITRAMFS_CACHE_MAX most recently used images; cache
+ * hits bump the mtime.
+ */
+static gboolean
+prune_initramfs_cache (int           cache_dfd,
+                       GCancellable *cancellable,
+                       GError      **error)
+{
+  g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+  if (!glnx_dirfd_iterator_init_at (cache_dfd, ".", FALSE, &dfd_iter, error))
+    return FALSE;
+
+  g_autoptr(GArray) entries = g_array_new (FALSE, FALSE, sizeof (CachedInitramfs));
+  g_array_set_clear_func (entries, cached_initramfs_clear);
+  while (TRUE)
+    {
+      struct dirent *dent = NULL;
+      if (!glnx_dirfd_iterator_next_dent_ensure_dtype (&dfd_iter, &dent, cancellable, error))
+        return FALSE;
+      if (!dent)
+        break;
+      if (dent->d_type != DT_REG || !g_str_has_suffix (dent->d_name, ".img"))
+        continue;
+
+      struct stat stbuf;
+      if (!glnx_fstatat (cache_dfd, dent->d_name, &stbuf, 0, error))
+        return FALSE;
+      CachedInitramfs entry = { g_strdup (dent->d_name), stbuf.st_mtime };
+      g_array_append_val (entries, entry);
+    }
+
+  g_array_sort (entries, compare_cached_initramfs);
+  for (guint i = RPMOSTREE_INITRAMFS_CACHE_MAX; i < entries->len; i++)
+    {
+      const char *name = g_array_index (entries, CachedInitramfs, i).name;
+      if (!glnx_unlinkat (cache_dfd, name, 0, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Look up @key in the initramfs cache; on a hit, copy it into a new tmpfile in
+ * @rootfs_dfd (reflinked where the filesystem supports it).
+ */
+static gboolean
+initramfs_cache_lookup (int           cache_dfd,
+                        const char   *key,
+                        int           rootfs_dfd,
+                        gboolean     *out_found,
+                        GLnxTmpfile  *out_tmpf,
+                        GError      **error)
+{
+  *out_found = FALSE;
+
+  g_autofree char *name = g_strconcat (key, ".img", NULL);
+  glnx_autofd int fd = -1;
+  if (!glnx_openat_rdonly (cache_dfd, name, TRUE, &fd, NULL))
+    return TRUE; /* Note early return; treat any error as a miss */
+
+  g_auto(GLnxTmpfile) tmpf = { 0, };
+  if (!glnx_open_tmpfile_linkable_at (rootfs_dfd, ".", O_RDWR | O_CLOEXEC,
+                                      &tmpf, error))
+    return FALSE;
+  if (glnx_regfile_copy_bytes (fd, tmpf.fd, (off_t)-1) < 0)
+    return glnx_throw_errno_prefix (error, "Copying cached initramfs");
+  if (lseek (tmpf.fd, 0, SEEK_SET) < 0)
+    return glnx_throw_errno_prefix (error, "lseek");
+
+  /* Mark it as recently used */
+  (void) futimens (fd, NULL);
+
+  *out_found = TRUE;
+  *out_tmpf = tmpf; tmpf.initialized = FALSE; /* Transfer */
+  return TRUE;
+}
+
+static gboolean
+initramfs_cache_store (int           cache_dfd,
+                       const char   *key,
+                       GLnxTmpfile  *initramfs_tmpf,
+                       GCancellable *cancellable,
+                       GError      **error)
+{
+  g_autofree char *name = g_strconcat (key, ".img", NULL);
+  g_auto(GLnxTmpfile) tmpf = { 0, };
+  if (!glnx_open_tmpfile_linkable_at (cache_dfd, ".", O_WRONLY | O_CLOEXEC,
+                                      &tmpf, error))
+    return FALSE;
+  if (lseek (initramfs_tmpf->fd, 0, SEEK_SET) < 0)
+    return glnx_throw_errno_prefix (error, "lseek");
+  if (glnx_regfile_copy_bytes (initramfs_tmpf->fd, tmpf.fd, (off_t)-1) < 0)
+    return glnx_throw_errno_prefix (error, "Copying initramfs to cache");
+  if (lseek (initramfs_tmpf->fd, 0, SEEK_SET) < 0)
+    return glnx_throw_errno_prefix (error, "lseek");
+  /* Initramfs images may embed secrets such as keyfiles */
+  if (fchmod (tmpf.fd, 0600) < 0)
+    return glnx_throw_errno_prefix (error, "fchmod");
+  if (!glnx_link_tmpfile_at (&tmpf, GLNX_LINK_TMPFILE_NOREPLACE_IGNORE_EXIST,
+                             cache_dfd, name, error))
+    return FALSE;
+
+  return prune_initramfs_cache (cache_dfd, cancellable, error);
+}
+
+/* Append to @argv the dracut arguments to compress the initramfs with @method
+ * (one of gzip, zstd, xz or lz4). For zstd and xz, @threads selects the number
+ * of compression threads, where 0 means one per CPU; a negative value keeps
+ * the compressor default. The output stays reproducible for given settings.
+ */
+gboolean
+rpmostree_dracut_append_compression_args (GPtrArray   *argv,
+                                          const char  *method,
+                                          gint64       threads,
+                                          GError     **error)
+{
+  if (g_str_equal (method, "gzip") || g_str_equal (method, "lz4"))
+    {
+      /* Dracut already uses pigz for gzip if it's installed */
+      if (threads >= 0)
+        return glnx_throw (error, "Compression threads are not supported for %s", method);
+      g_ptr_array_add (argv, g_strconcat ("--", method, NULL));
+    }
+  else if (g_str_equal (method, "zstd") || g_str_equal (method, "xz"))
+    {
+      if (threads < 0)
+        g_ptr_array_add (argv, g_strconcat ("--", method, NULL));
+      else
+        {
+          /* These mirror the defaults dracut uses for --zstd and --xz */
+          g_ptr_array_add (argv, g_strdup ("--compress"));
+          if (g_str_equal (method, "zstd"))
+            g_ptr_array_add (argv, g_strdup_printf ("zstd -15 -q -T%" G_GINT64_FORMAT, threads));
+          else
+            g_ptr_array_add (argv, g_strdup_printf ("xz --check=crc32 --lzma2=dict=1MiB -T%" G_GINT64_FORMAT,
+                                                    threads));
+        }
+    }
+  else
+    return glnx_throw (error, "Unknown initramfs compression '%s'", method);
+
+  return TRUE;
+}
+
 gboolean
 rpmostree_run_dracut (int     rootfs_dfd,
                       const char *const* argv,
                       const char *kver,
                       const char *rebuild_from_initramfs,
                       GLnxTmpDir  *dracut_host_tmpdir,
+                      int          cache_dfd,
                       GLnxTmpfile *out_initramfs_tmpf,
                       GCancellable  *cancellable,
                       GError **error)
@@ -377,11 +665,19 @@ rpmostree_run_dracut (int     rootfs_dfd,
    * to dracut.
    */
   static const char rpmostree_dracut_wrapper_path[] = "usr/bin/rpmostree-dracut-wrapper";
-  /* This also hardcodes a few arguments */
+  /* This also hardcodes a few arguments; we default to gzip unless the caller
+   * picked a compression method.
+   */
   static const char rpmostree_dracut_wrapper[] =
     "#!/usr/bin/bash\n"
     "set -euo pipefail\n"
-    "extra_argv=; if (dracut --help; true) | grep -q -e --reproducible; then extra_argv=\"--reproducible --gzip\"; fi\n"
+    "extra_argv=; if (dracut --help; true) | grep -q -e --reproducible; then\n"
+    "  extra_argv=--reproducible; compress=--gzip\n"
+    "  for arg in \"$@\"; do case \"$arg\" in\n"
+    "    --gzip|--bzip2|--lzma|--xz|--lzo|--lz4|--zstd|--compress|--compress=*|--no-compress) compress=;;\n"
+    "  esac; done\n"
+    "  extra_argv=\"$extra_argv $compress\"\n"
+    "fi\n"
     "dracut $extra_argv -v --add ostree --tmpdir=/tmp -f /tmp/initramfs.img \"$@\"\n"
     "cat /tmp/initramfs.img >/proc/self/fd/3\n";
   g_autoptr(RpmOstreeBwrap) bwrap = NULL;
@@ -405,6 +701,45 @@ rpmostree_run_dracut (int     rootfs_dfd,
       argv = (const char *const*)rebuild_argv->pdata;
     }
 
+  /* If we're rebuilding, we use the *current* /etc so we pick up any modified
+   * config files.  Otherwise, we use the usr/etc defaults.
+   */
+  const char *etc_path = rebuild_from_initramfs ? "/etc" : "usr/etc";
+
+  /* See if we already generated an initramfs from the same inputs */
+  glnx_autofd int initramfs_cache_dfd = -1;
+  g_autofree char *cache_key = NULL;
+  if (cache_dfd != -1)
+    {
+      if (!glnx_shutil_mkdir_p_at (cache_dfd, RPMOSTREE_DIR_CACHE_INITRAMFS, 0700,
+                                   cancellable, error))
+        return FALSE;
+      if (!glnx_opendirat (cache_dfd, RPMOSTREE_DIR_CACHE_INITRAMFS, TRUE,
+                           &initramfs_cache_dfd, error))
+        return FALSE;
+      /* In case it was created with looser permissions before */
+      if (fchmod (initramfs_cache_dfd, 0700) < 0)
+        return glnx_throw_errno_prefix (error, "fchmod");
+      cache_key = compute_initramfs_cache_key (rootfs_dfd, rpmostree_dracut_wrapper,
+                                               argv, kver, etc_path,
+                                               rebuild_from_initramfs,
+                                               cancellable, error);
+      if (!cache_key)
+        return FALSE;
+
+      gboolean found = FALSE;
+      if (!initramfs_cache_lookup (initramfs_cache_dfd, cache_key, rootfs_dfd,
+                                   &found, out_initramfs_tmpf, error))
+        return FALSE;
+      if (found)
+        {
+          g_print ("Using cached initramfs %s\n", cache_key);
+          if (rebuild_from_initramfs)
+            (void) unlinkat (rootfs_dfd, rebuild_from_initramfs, 0);
+          return TRUE; /* Note early return */
+        }
+    }
+
   /* First tempfile is just our shell script */
   if (!glnx_open_tmpfile_linkable_at (rootfs_dfd, "usr/bin",
                                       O_RDWR | O_CLOEXEC,
@@ -433,17 +768,9 @@ rpmostree_run_dracut (int     rootfs_dfd,
                                       &tmpf, error))
     goto out;
 
-  /* If we're rebuilding, we use the *current* /etc so we pick up any modified
-   * config files.  Otherwise, we use the usr/etc defaults.
-   */
-  if (rebuild_from_initramfs)
-    bwrap = rpmostree_bwrap_new (rootfs_dfd, RPMOSTREE_BWRAP_IMMUTABLE, error,
-                                 "--ro-bind", "/etc", "/etc",
-                                 NULL);
-  else
-    bwrap = rpmostree_bwrap_new (rootfs_dfd, RPMOSTREE_BWRAP_IMMUTABLE, error,
-                                 "--ro-bind", "usr/etc", "/etc",
-                                 NULL);
+  bwrap = rpmostree_bwrap_new (rootfs_dfd, RPMOSTREE_BWRAP_IMMUTABLE, error,
+                               "--ro-bind", etc_path, "/etc",
+                               NULL);
   if (!bwrap)
     return FALSE;
 
@@ -463,12 +790,30 @@ rpmostree_run_dracut (int     rootfs_dfd,
 
   rpmostree_bwrap_set_child_setup (bwrap, dracut_child_setup, GINT_TO_POINTER (tmpf.fd));
 
+  const guint64 start_time = g_get_monotonic_time ();
   if (!rpmostree_bwrap_run (bwrap, cancellable, error))
     goto out;
+  const guint64 end_time = g_get_monotonic_time ();
+
+  /* Report the cost of the chosen compression settings */
+  { struct stat stbuf;
+    if (!glnx_fstat (tmpf.fd, &stbuf, error))
+      goto out;
+    g_autofree char *size = g_format_size (stbuf.st_size);
+    g_print ("Generated initramfs in %.1f seconds, size %s\n",
+             (end_time - start_time) / (double)G_USEC_PER_SEC, size);
+  }
 
   if (rebuild_from_initramfs)
     (void) unlinkat (rootfs_dfd, rebuild_from_initramfs, 0);
 
+  if (cache_key)
+    {
+      if (!initramfs_cache_store (initramfs_cache_dfd, cache_key, &tmpf,
+                                  cancellable, error))
+        goto out;
+    }
+
   ret = TRUE;
   *out_initramfs_tmpf = tmpf; tmpf.initialized = FALSE; /* Transfer */
  out:
@@ -44,12 +44,19 @@ rpmostree_finalize_kernel (int rootfs_dfd,
                            GCancellable *cancellable,
                            GError **error);
 
+gboolean
+rpmostree_dracut_append_compression_args (GPtrArray   *argv,
+                                          const char  *method,
+                                          gint64       threads,
+                                          GError     **error);
+
 gboolean
 rpmostree_run_dracut (int     rootfs_dfd,
                       const char *const* argv,
                       const char *kver,
                       const char *rebuild_from_initramfs,
                       GLnxTmpDir  *dracut_host_tmpdir,
+                      int          cache_dfd,
                       GLnxTmpfile *out_initramfs_tmpf,
                       GCancellable  *cancellable,
                       GError **error);
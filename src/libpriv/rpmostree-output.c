@@ -19,6 +19,8 @@
 #include "config.h"
 
 #include <ostree.h>
+#include <json-glib/json-glib.h>
+#include <systemd/sd-journal.h>
 #include <libglnx.h>
 
 #include "rpmostree-output.h"
@@ -28,8 +30,26 @@
  * terminal. This is helpful in situations in which code may be executed both
  * from the daemon and daemon-less. */
 
+#define RPMOSTREE_MESSAGE_TASK_TIMING SD_ID128_MAKE(01,2d,cb,14,1b,a0,4f,b9,bf,a6,4c,a7,03,b0,0a,71)
+#define RPMOSTREE_MESSAGE_PHASE_TIMING SD_ID128_MAKE(39,dc,e4,00,4f,4a,49,56,b8,2d,25,98,5b,27,4b,da)
+
 static GLnxConsoleRef console;
 
+/* Tasks don't nest, so we only need to track the current one */
+static char *task_text;
+static gint64 task_start_time;
+
+/* Only collected if someone asked for a report; the daemon is long-lived */
+typedef struct {
+  char *name;
+  const char *kind;
+  gint64 duration_usec;
+} RpmOstreeTiming;
+
+static GMutex timings_lock;
+static gboolean timings_enabled;
+static GArray *timings;
+
 void
 rpmostree_output_default_handler (RpmOstreeOutputType type,
                                   void *data,
@@ -96,12 +116,42 @@ rpmostree_output_message (const char *format, ...)
   active_cb (RPMOSTREE_OUTPUT_MESSAGE, &task, active_cb_opaque);
 }
 
+static void
+timing_clear (gpointer data)
+{
+  RpmOstreeTiming *timing = data;
+  g_free (timing->name);
+}
+
+static void
+record_timing (const char *kind,
+               const char *name,
+               gint64      duration_usec)
+{
+  g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&timings_lock);
+  if (!timings_enabled)
+    return;
+
+  if (!timings)
+    {
+      timings = g_array_new (FALSE, FALSE, sizeof (RpmOstreeTiming));
+      g_array_set_clear_func (timings, timing_clear);
+    }
+
+  RpmOstreeTiming timing = { g_strdup (name), kind, duration_usec };
+  g_array_append_val (timings, timing);
+}
+
 void
 rpmostree_output_task_begin (const char *format, ...)
 {
   g_autofree char *final_msg = strdup_vprintf (format);
   RpmOstreeOutputTaskBegin task = { final_msg };
   active_cb (RPMOSTREE_OUTPUT_TASK_BEGIN, &task, active_cb_opaque);
+
+  g_free (task_text);
+  task_text = g_steal_pointer (&final_msg);
+  task_start_time = g_get_monotonic_time ();
 }
 
 void
@@ -110,6 +160,19 @@ rpmostree_output_task_end (const char *format, ...)
   g_autofree char *final_msg = strdup_vprintf (format);
   RpmOstreeOutputTaskEnd task = { final_msg };
   active_cb (RPMOSTREE_OUTPUT_TASK_END, &task, active_cb_opaque);
+
+  if (task_text)
+    {
+      const gint64 duration_usec = g_get_monotonic_time () - task_start_time;
+      sd_journal_send ("MESSAGE_ID=" SD_ID128_FORMAT_STR, SD_ID128_FORMAT_VAL(RPMOSTREE_MESSAGE_TASK_TIMING),
+                       "MESSAGE=%s: %s (%.3fs)", task_text, final_msg,
+                       (double)duration_usec / G_USEC_PER_SEC,
+                       "RPMOSTREE_TASK=%s", task_text,
+                       "RPMOSTREE_TASK_DURATION_USEC=%" G_GINT64_FORMAT, duration_usec,
+                       NULL);
+      record_timing ("task", task_text, duration_usec);
+      g_clear_pointer (&task_text, g_free);
+    }
 }
 
 void
@@ -131,3 +194,68 @@ rpmostree_output_progress_end (void)
 {
   active_cb (RPMOSTREE_OUTPUT_PROGRESS_END, NULL, active_cb_opaque);
 }
+
+RpmOstreeOutputPhase
+rpmostree_output_phase_begin (const char *name)
+{
+  RpmOstreeOutputPhase phase = { name, g_get_monotonic_time () };
+  return phase;
+}
+
+void
+rpmostree_output_phase_end (RpmOstreeOutputPhase *phase)
+{
+  if (!phase->name)
+    return;
+
+  const gint64 duration_usec = g_get_monotonic_time () - phase->start_time;
+  sd_journal_send ("MESSAGE_ID=" SD_ID128_FORMAT_STR, SD_ID128_FORMAT_VAL(RPMOSTREE_MESSAGE_PHASE_TIMING),
+                   "MESSAGE=Phase %s took %.3fs", phase->name,
+                   (double)duration_usec / G_USEC_PER_SEC,
+                   "RPMOSTREE_PHASE=%s", phase->name,
+                   "RPMOSTREE_PHASE_DURATION_USEC=%" G_GINT64_FORMAT, duration_usec,
+                   NULL);
+  record_timing ("phase", phase->name, duration_usec);
+  phase->name = NULL;
+}
+
+/* Start collecting task and phase durations for rpmostree_output_timings_write() */
+void
+rpmostree_output_timings_enable (void)
+{
+  g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&timings_lock);
+  timings_enabled = TRUE;
+}
+
+/* Write the collected durations as a JSON array, in completion order */
+gboolean
+rpmostree_output_timings_write (const char *path,
+                                GError    **error)
+{
+  g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&timings_lock);
+  glnx_unref_object JsonBuilder *builder = json_builder_new ();
+  json_builder_begin_array (builder);
+  for (guint i = 0; timings && i < timings->len; i++)
+    {
+      RpmOstreeTiming *timing = &g_array_index (timings, RpmOstreeTiming, i);
+      json_builder_begin_object (builder);
+      json_builder_set_member_name (builder, "kind");
+      json_builder_add_string_value (builder, timing->kind);
+      json_builder_set_member_name (builder, "name");
+      json_builder_add_string_value (builder, timing->name);
+      json_builder_set_member_name (builder, "duration-usec");
+      json_builder_add_int_value (builder, timing->duration_usec);
+      json_builder_end_object (builder);
+    }
+  json_builder_end_array (builder);
+
+  JsonNode *root = json_builder_get_root (builder);
+  glnx_unref_object JsonGenerator *generator = json_generator_new ();
+  json_generator_set_pretty (generator, TRUE);
+  json_generator_set_root (generator, root);
+  json_node_free (root);
+  if (!json_generator_to_file (generator, path, error))
+    return glnx_prefix_error (error, "Writing timings to %s", path);
+
+  return TRUE;
+}
@@ -69,3 +69,26 @@ rpmostree_output_progress_percent (const char *text, int percentage);
 
 void
 rpmostree_output_progress_end (void);
+
+/* Timing of the major phases of a transaction or compose (depsolve, import,
+ * commit...). The duration is logged to the journal when the phase ends or,
+ * using g_auto(), when it goes out of scope. */
+typedef struct {
+  const char *name;
+  gint64 start_time;
+} RpmOstreeOutputPhase;
+
+RpmOstreeOutputPhase
+rpmostree_output_phase_begin (const char *name);
+
+void
+rpmostree_output_phase_end (RpmOstreeOutputPhase *phase);
+
+G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC(RpmOstreeOutputPhase, rpmostree_output_phase_end)
+
+void
+rpmostree_output_timings_enable (void);
+
+gboolean
+rpmostree_output_timings_write (const char *path,
+                                GError    **error);
@@ -36,20 +36,18 @@
 
 #include "libglnx.h"
 
-/* Recursively search a directory for a subpath
- * owned by a uid/gid.
+/* Recursively walk a directory, adding the uid (or gid) owning each subpath
+ * to @ids. We gather everything in a single pass so that checking any number
+ * of removed users/groups only requires walking the tree once.
  */
 static gboolean
-dir_contains_uid_or_gid (int            rootfs_fd,
-                         const char    *path,
-                         guint32        id,
-                         gboolean       is_uid,
-                         gboolean      *out_found_match,
-                         GCancellable  *cancellable,
-                         GError       **error)
+dir_collect_uids_or_gids (int            rootfs_fd,
+                          const char    *path,
+                          gboolean       is_uid,
+                          GHashTable    *ids,
+                          GCancellable  *cancellable,
+                          GError       **error)
 {
-  gboolean found_match = FALSE;
-
   g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
   if (!glnx_dirfd_iterator_init_at (rootfs_fd, path, FALSE, &dfd_iter, error))
     return FALSE;
@@ -58,18 +56,7 @@ dir_contains_uid_or_gid (int            rootfs_fd,
   struct stat stbuf;
   if (!glnx_fstat (dfd_iter.fd, &stbuf, error))
     return FALSE;
-
-  if (is_uid)
-    found_match = (id == stbuf.st_uid);
-  else
-    found_match = (id == stbuf.st_gid);
-
-  /* Early return if we found a match */
-  if (found_match)
-    {
-      *out_found_match = TRUE;
-      return TRUE;
-    }
+  g_hash_table_add (ids, GUINT_TO_POINTER (is_uid ? stbuf.st_uid : stbuf.st_gid));
 
   /* Loop over the directory contents */
   while (TRUE)
@@ -82,52 +69,43 @@ dir_contains_uid_or_gid (int            rootfs_fd,
 
       if (dent->d_type == DT_DIR)
         {
-          if (!dir_contains_uid_or_gid (dfd_iter.fd, dent->d_name,
-                                        id, is_uid, out_found_match,
-                                        cancellable, error))
+          if (!dir_collect_uids_or_gids (dfd_iter.fd, dent->d_name, is_uid, ids,
+                                         cancellable, error))
             return FALSE;
         }
       else
         {
           if (!glnx_fstatat (dfd_iter.fd, dent->d_name, &stbuf, AT_SYMLINK_NOFOLLOW, error))
             return FALSE;
-
-          if (is_uid)
-            found_match = (id == stbuf.st_uid);
-          else
-            found_match = (id == stbuf.st_gid);
+          g_hash_table_add (ids, GUINT_TO_POINTER (is_uid ? stbuf.st_uid : stbuf.st_gid));
         }
-
-      if (found_match)
-        break;
     }
 
-  *out_found_match = found_match;
   return TRUE;
 }
 
+/* Check whether any subpath of the rootfs is owned by @id. The set of owners
+ * is computed on first use and cached in @ids_cache.
+ */
 static gboolean
-dir_contains_uid (int              rootfs_fd,
-                  uid_t            uid,
-                  gboolean        *out_found_match,
-                  GCancellable    *cancellable,
-                  GError         **error)
+rootfs_contains_uid_or_gid (int              rootfs_fd,
+                            guint32          id,
+                            gboolean         is_uid,
+                            GHashTable     **ids_cache,
+                            gboolean        *out_found_match,
+                            GCancellable    *cancellable,
+                            GError         **error)
 {
-  *out_found_match = FALSE;
-  return dir_contains_uid_or_gid (rootfs_fd, ".", uid, TRUE,
-                                  out_found_match, cancellable, error);
-}
+  if (!*ids_cache)
+    {
+      g_autoptr(GHashTable) ids = g_hash_table_new (NULL, NULL);
+      if (!dir_collect_uids_or_gids (rootfs_fd, ".", is_uid, ids, cancellable, error))
+        return FALSE;
+      *ids_cache = g_steal_pointer (&ids);
+    }
 
-static gboolean
-dir_contains_gid (int              rootfs_fd,
-                  gid_t            gid,
-                  gboolean        *out_found_match,
-                  GCancellable    *cancellable,
-                  GError         **error)
-{
-  *out_found_match = FALSE;
-  return dir_contains_uid_or_gid (rootfs_fd, ".", gid, FALSE,
-                                  out_found_match, cancellable, error);
+  *out_found_match = g_hash_table_contains (*ids_cache, GUINT_TO_POINTER (id));
+  return TRUE;
 }
 
 static void
@@ -235,6 +213,8 @@ rpmostree_check_passwd_groups (gboolean         passwd,
   gboolean ignore_all_removed = FALSE;
   g_autoptr(GPtrArray) old_ents = NULL;
   g_autoptr(GPtrArray) new_ents = NULL;
+  /* Owners of files in the rootfs; only computed if an entry was removed */
+  g_autoptr(GHashTable) rootfs_ids = NULL;
 
   if (json_object_has_member (treedata, json_conf_name))
     {
@@ -440,8 +420,8 @@ rpmostree_check_passwd_groups (gboolean         passwd,
             }
           else
             {
-              if (!dir_contains_uid (rootfs_fd, odata->uid, &found_matching_uid,
-                                     cancellable, error))
+              if (!rootfs_contains_uid_or_gid (rootfs_fd, odata->uid, TRUE, &rootfs_ids,
+                                               &found_matching_uid, cancellable, error))
                 return FALSE;
 
               if (found_matching_uid)
@@ -490,8 +470,8 @@ rpmostree_check_passwd_groups (gboolean         passwd,
             {
               gboolean found_gid;
 
-              if (!dir_contains_gid (rootfs_fd, odata->gid, &found_gid,
-                                     cancellable, error))
+              if (!rootfs_contains_uid_or_gid (rootfs_fd, odata->gid, FALSE, &rootfs_ids,
+                                               &found_gid, cancellable, error))
                 return FALSE;
 
               if (found_gid)
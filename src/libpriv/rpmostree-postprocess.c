@@ -37,6 +37,7 @@
 #include <stdlib.h>
 #include <gio/gunixinputstream.h>
 #include <gio/gunixoutputstream.h>
+#include <gio/gfiledescriptorbased.h>
 
 #include "rpmostree-postprocess.h"
 #include "rpmostree-kernel.h"
@@ -243,6 +244,255 @@ hardlink_recurse (int                src_dfd,
   return TRUE;
 }
 
+/* Files in usr/lib/modules/$kver which aren't inputs to depmod, but are added
+ * later by rpmostree_finalize_kernel().
+ */
+static gboolean
+is_depmod_ignored (const char *name)
+{
+  return g_str_equal (name, "vmlinuz") || g_str_equal (name, "initramfs.img");
+}
+
+/* depmod writes its outputs as modules.* next to the modules. Kernel packages
+ * also ship some inputs with that prefix (e.g. modules.builtin), but those are
+ * already present in the new rootfs before depmod runs, whereas the outputs
+ * aren't.
+ */
+static gboolean
+is_depmod_output (const char *name)
+{
+  return g_str_has_prefix (name, "modules.");
+}
+
+/* Sets @out_linked to whether @stbuf is a hardlink to the content object
+ * @checksum in @repo; i.e. whether the two have the same content without
+ * having to read either of them.
+ */
+static gboolean
+is_hardlink_to_object (OstreeRepo   *repo,
+                       const char   *checksum,
+                       struct stat  *stbuf,
+                       gboolean     *out_linked,
+                       GCancellable *cancellable,
+                       GError      **error)
+{
+  *out_linked = FALSE;
+
+  g_autoptr(GInputStream) in = NULL;
+  g_autoptr(GError) local_error = NULL;
+  if (!ostree_repo_load_file (repo, checksum, &in, NULL, NULL, cancellable, &local_error))
+    {
+      if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        return TRUE;
+      return g_propagate_error (error, g_steal_pointer (&local_error)), FALSE;
+    }
+  /* Objects in archive repos aren't hardlinkable */
+  if (!in || !G_IS_FILE_DESCRIPTOR_BASED (in))
+    return TRUE;
+
+  struct stat obj_stbuf;
+  if (!glnx_fstat (g_file_descriptor_based_get_fd ((GFileDescriptorBased*)in), &obj_stbuf, error))
+    return FALSE;
+  *out_linked = (obj_stbuf.st_dev == stbuf->st_dev && obj_stbuf.st_ino == stbuf->st_ino);
+  return TRUE;
+}
+
+/* Compare @path in @rootfs_dfd against @prev (from the previous commit),
+ * recursively. Only the content, file type and permissions are compared, as
+ * that's all depmod cares about. We never read file contents: a regular file
+ * only matches if it's a hardlink to the previous commit's content object in
+ * @pkgcache_repo, which is the case for files checked out from an unchanged
+ * package. Anything else counts as changed.
+ *
+ * If @out_outputs is set, @path is the modules directory; entries which aren't
+ * inputs to depmod are ignored in its toplevel, and the names of depmod outputs
+ * found in @prev are added to @out_outputs.
+ */
+static gboolean
+path_matches_previous (int           rootfs_dfd,
+                       const char   *path,
+                       GFile        *prev,
+                       OstreeRepo   *pkgcache_repo,
+                       GPtrArray    *out_outputs,
+                       gboolean     *out_matches,
+                       GCancellable *cancellable,
+                       GError      **error)
+{
+  *out_matches = FALSE;
+
+  struct stat stbuf;
+  if (!glnx_fstatat_allow_noent (rootfs_dfd, path, &stbuf, AT_SYMLINK_NOFOLLOW, error))
+    return FALSE;
+  const gboolean exists = (errno == 0);
+
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GFileInfo) prev_info =
+    g_file_query_info (prev, OSTREE_GIO_FAST_QUERYINFO,
+                       G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, cancellable, &local_error);
+  if (!prev_info && !g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+    return g_propagate_error (error, g_steal_pointer (&local_error)), FALSE;
+
+  if (!exists || !prev_info)
+    {
+      *out_matches = (!exists && !prev_info);
+      return TRUE;
+    }
+
+  const guint32 prev_mode = g_file_info_get_attribute_uint32 (prev_info, "unix::mode");
+  if (stbuf.st_mode != prev_mode)
+    return TRUE; /* Note early return */
+
+  if (S_ISREG (stbuf.st_mode))
+    {
+      if (stbuf.st_size != g_file_info_get_size (prev_info))
+        return TRUE; /* Note early return */
+
+      const char *prev_checksum = ostree_repo_file_get_checksum ((OstreeRepoFile*)prev);
+      if (!is_hardlink_to_object (pkgcache_repo, prev_checksum, &stbuf, out_matches,
+                                  cancellable, error))
+        return FALSE;
+    }
+  else if (S_ISLNK (stbuf.st_mode))
+    {
+      g_autofree char *target = glnx_readlinkat_malloc (rootfs_dfd, path, cancellable, error);
+      if (!target)
+        return FALSE;
+      *out_matches = g_str_equal (target, g_file_info_get_symlink_target (prev_info));
+    }
+  else if (S_ISDIR (stbuf.st_mode))
+    {
+      const gboolean is_modules_dir = (out_outputs != NULL);
+      g_autoptr(GHashTable) names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+      g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+      if (!glnx_dirfd_iterator_init_at (rootfs_dfd, path, FALSE, &dfd_iter, error))
+        return FALSE;
+      while (TRUE)
+        {
+          struct dirent *dent = NULL;
+          if (!glnx_dirfd_iterator_next_dent (&dfd_iter, &dent, cancellable, error))
+            return FALSE;
+          if (!dent)
+            break;
+          if (is_modules_dir && is_depmod_ignored (dent->d_name))
+            continue;
+          g_hash_table_add (names, g_strdup (dent->d_name));
+        }
+
+      g_autoptr(GFileEnumerator) direnum =
+        g_file_enumerate_children (prev, "standard::name", G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                   cancellable, error);
+      if (!direnum)
+        return FALSE;
+      guint n_prev = 0;
+      while (TRUE)
+        {
+          GFileInfo *child_info = NULL;
+          if (!g_file_enumerator_iterate (direnum, &child_info, NULL, cancellable, error))
+            return FALSE;
+          if (!child_info)
+            break;
+          const char *name = g_file_info_get_name (child_info);
+          if (is_modules_dir && is_depmod_ignored (name))
+            continue;
+          if (!g_hash_table_contains (names, name))
+            {
+              if (is_modules_dir && is_depmod_output (name))
+                {
+                  g_ptr_array_add (out_outputs, g_strdup (name));
+                  continue;
+                }
+              return TRUE; /* Note early return */
+            }
+          n_prev++;
+        }
+      if (n_prev != g_hash_table_size (names))
+        return TRUE; /* Note early return */
+
+      GLNX_HASH_TABLE_FOREACH (names, const char*, name)
+        {
+          g_autofree char *subpath = g_build_filename (path, name, NULL);
+          g_autoptr(GFile) prev_child = g_file_get_child (prev, name);
+          gboolean child_matches = FALSE;
+          if (!path_matches_previous (rootfs_dfd, subpath, prev_child, pkgcache_repo, NULL,
+                                      &child_matches, cancellable, error))
+            return FALSE;
+          if (!child_matches)
+            return TRUE; /* Note early return */
+        }
+      *out_matches = TRUE;
+    }
+
+  return TRUE;
+}
+
+/* If the inputs to depmod for @kver are unchanged from @previous_root, copy
+ * its outputs from there instead of running depmod again. Sets
+ * @out_reused to whether we did so.
+ */
+static gboolean
+reuse_previous_depmod (int           rootfs_dfd,
+                       const char   *kver,
+                       GFile        *previous_root,
+                       OstreeRepo   *pkgcache_repo,
+                       gboolean     *out_reused,
+                       GCancellable *cancellable,
+                       GError      **error)
+{
+  *out_reused = FALSE;
+
+  g_autofree char *modules_path = g_strconcat ("usr/lib/modules/", kver, NULL);
+  g_autoptr(GPtrArray) outputs = g_ptr_array_new_with_free_func (g_free);
+  struct { const char *path; GPtrArray *outputs; } inputs[] = {
+    { modules_path, outputs },
+    { "usr/lib/depmod.d", NULL },
+    { "usr/etc/depmod.d", NULL },
+    { "usr/bin/kmod", NULL },
+  };
+  for (guint i = 0; i < G_N_ELEMENTS (inputs); i++)
+    {
+      g_autoptr(GFile) prev = g_file_resolve_relative_path (previous_root, inputs[i].path);
+      gboolean matches = FALSE;
+      if (!path_matches_previous (rootfs_dfd, inputs[i].path, prev, pkgcache_repo,
+                                  inputs[i].outputs, &matches, cancellable, error))
+        return FALSE;
+      if (!matches)
+        return TRUE; /* Note early return */
+    }
+  /* Previous commit didn't run depmod? */
+  if (outputs->len == 0)
+    return TRUE;
+
+  glnx_autofd int modules_dfd = -1;
+  if (!glnx_opendirat (rootfs_dfd, modules_path, TRUE, &modules_dfd, error))
+    return FALSE;
+  g_autoptr(GFile) prev_modules = g_file_resolve_relative_path (previous_root, modules_path);
+  for (guint i = 0; i < outputs->len; i++)
+    {
+      const char *name = outputs->pdata[i];
+      g_autoptr(GFile) prev = g_file_get_child (prev_modules, name);
+      g_autoptr(GInputStream) in = (GInputStream*)g_file_read (prev, cancellable, error);
+      if (!in)
+        return FALSE;
+
+      g_auto(GLnxTmpfile) tmpf = { 0, };
+      if (!glnx_open_tmpfile_linkable_at (modules_dfd, ".", O_WRONLY | O_CLOEXEC,
+                                          &tmpf, error))
+        return FALSE;
+      g_autoptr(GOutputStream) out = g_unix_output_stream_new (tmpf.fd, FALSE);
+      if (g_output_stream_splice (out, in, G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE,
+                                  cancellable, error) < 0)
+        return FALSE;
+      if (fchmod (tmpf.fd, 0644) < 0)
+        return glnx_throw_errno_prefix (error, "fchmod");
+      if (!glnx_link_tmpfile_at (&tmpf, GLNX_LINK_TMPFILE_NOREPLACE,
+                                 modules_dfd, name, error))
+        return FALSE;
+    }
+
+  *out_reused = TRUE;
+  return TRUE;
+}
+
 /* Handle the kernel/initramfs, which can be in at least 2 different places:
  *  - /boot (CentOS, Fedora treecompose before we suppressed kernel.spec's %posttrans)
  *  - /usr/lib/modules (Fedora treecompose without kernel.spec's %posttrans)
@@ -254,6 +504,9 @@ static gboolean
 process_kernel_and_initramfs (int            rootfs_dfd,
                               JsonObject    *treefile,
                               gboolean       unified_core_mode,
+                              GFile         *previous_root,
+                              OstreeRepo    *pkgcache_repo,
+                              int            cache_dfd,
                               GCancellable  *cancellable,
                               GError       **error)
 {
@@ -326,13 +579,26 @@ process_kernel_and_initramfs (int            rootfs_dfd,
     }
 
   /* Ensure depmod (kernel modules index) is up to date; because on Fedora we
-   * suppress the kernel %posttrans we need to take care of this.
+   * suppress the kernel %posttrans we need to take care of this. Most composes
+   * don't change the kernel though, in which case we can reuse the previous
+   * commit's index. We can only tell cheaply that the modules are unchanged if
+   * they were checked out from the pkgcache (i.e. unified core).
    */
-  {
-    char *child_argv[] = { "depmod", (char*)kver, NULL };
-    if (!run_bwrap_mutably (rootfs_dfd, "depmod", child_argv, unified_core_mode, cancellable, error))
-      return FALSE;
-  }
+  gboolean reused_depmod = FALSE;
+  if (previous_root && pkgcache_repo)
+    {
+      if (!reuse_previous_depmod (rootfs_dfd, kver, previous_root, pkgcache_repo,
+                                  &reused_depmod, cancellable, error))
+        return glnx_prefix_error (error, "Comparing kernel modules to previous commit");
+    }
+  if (reused_depmod)
+    g_print ("Kernel modules unchanged; reusing previous depmod output\n");
+  else
+    {
+      char *child_argv[] = { "depmod", (char*)kver, NULL };
+      if (!run_bwrap_mutably (rootfs_dfd, "depmod", child_argv, unified_core_mode, cancellable, error))
+        return FALSE;
+    }
 
   RpmOstreePostprocessBootLocation boot_location =
     RPMOSTREE_POSTPROCESS_BOOT_LOCATION_BOTH;
@@ -364,7 +630,30 @@ process_kernel_and_initramfs (int            rootfs_dfd,
     return FALSE;
 
   /* Run dracut with our chosen arguments (commonly at least --no-hostonly) */
-  g_autoptr(GPtrArray) dracut_argv = g_ptr_array_new ();
+  g_autoptr(GPtrArray) dracut_argv = g_ptr_array_new_with_free_func (g_free);
+  const char *compression = NULL;
+  if (!_rpmostree_jsonutil_object_get_optional_string_member (treefile, "initramfs-compression",
+                                                              &compression, error))
+    return FALSE;
+  gint64 compression_threads = -1;
+  gboolean have_compression_threads = FALSE;
+  if (!_rpmostree_jsonutil_object_get_optional_int_member (treefile, "initramfs-compression-threads",
+                                                           &compression_threads,
+                                                           &have_compression_threads, error))
+    return FALSE;
+  if (have_compression_threads && !compression)
+    return glnx_throw (error, "initramfs-compression-threads requires initramfs-compression");
+  if (have_compression_threads && compression_threads < 0)
+    return glnx_throw (error, "Invalid initramfs-compression-threads %" G_GINT64_FORMAT,
+                       compression_threads);
+  if (compression)
+    {
+      g_print ("Using initramfs compression: %s\n", compression);
+      if (!rpmostree_dracut_append_compression_args (dracut_argv, compression,
+                                                     have_compression_threads ? compression_threads : -1,
+                                                     error))
+        return FALSE;
+    }
   if (treefile && json_object_has_member (treefile, "initramfs-args"))
     {
       JsonArray *initramfs_args = json_object_get_array_member (treefile, "initramfs-args");
@@ -375,13 +664,13 @@ process_kernel_and_initramfs (int            rootfs_dfd,
           const char *arg = _rpmostree_jsonutil_array_require_string_element (initramfs_args, i, error);
           if (!arg)
             return FALSE;
-          g_ptr_array_add (dracut_argv, (char*)arg);
+          g_ptr_array_add (dracut_argv, g_strdup (arg));
         }
     }
   else
     {
       /* Default to this for treecomposes */
-      g_ptr_array_add (dracut_argv, (char*)"--no-hostonly");
+      g_ptr_array_add (dracut_argv, g_strdup ("--no-hostonly"));
     }
   g_ptr_array_add (dracut_argv, NULL);
 
@@ -392,7 +681,7 @@ process_kernel_and_initramfs (int            rootfs_dfd,
       return FALSE;
     if (!rpmostree_run_dracut (rootfs_dfd,
                                (const char *const*)dracut_argv->pdata, kver,
-                               NULL, &dracut_host_tmpd,
+                               NULL, &dracut_host_tmpd, cache_dfd,
                                &initramfs_tmpf, cancellable, error))
       return FALSE;
   }
@@ -898,6 +1187,9 @@ gboolean
 rpmostree_postprocess_final (int            rootfs_dfd,
                              JsonObject    *treefile,
                              gboolean       unified_core_mode,
+                             GFile         *previous_root,
+                             OstreeRepo    *pkgcache_repo,
+                             int            cache_dfd,
                              GCancellable  *cancellable,
                              GError       **error)
 {
@@ -992,6 +1284,7 @@ rpmostree_postprocess_final (int            rootfs_dfd,
         return FALSE;
 
       if (!process_kernel_and_initramfs (rootfs_dfd, treefile, unified_core_mode,
+                                         previous_root, pkgcache_repo, cache_dfd,
                                          cancellable, error))
         return glnx_prefix_error (error, "During kernel processing");
     }
@@ -75,6 +75,9 @@ gboolean
 rpmostree_postprocess_final (int            rootfs_dfd,
                              JsonObject    *treefile,
                              gboolean       unified_core_mode,
+                             GFile         *previous_root,
+                             OstreeRepo    *pkgcache_repo,
+                             int            cache_dfd,
                              GCancellable  *cancellable,
                              GError       **error);
 
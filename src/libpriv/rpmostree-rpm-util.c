@@ -147,20 +147,6 @@ pkg_nevra_strdup (Header h1)
                                                    PKG_NEVRA_FLAGS_ARCH);
 }
 
-static char *
-pkg_na_strdup (Header h1)
-{
-  return rpmostree_header_custom_nevra_strdup (h1, PKG_NEVRA_FLAGS_NAME |
-                                                   PKG_NEVRA_FLAGS_ARCH);
-}
-
-static char *
-pkg_nvr_strdup (Header h1)
-{
-  return rpmostree_header_custom_nevra_strdup (h1, PKG_NEVRA_FLAGS_NAME |
-                                                   PKG_NEVRA_FLAGS_VERSION_RELEASE);
-}
-
 static char *
 pkg_evra_strdup (Header h1)
 {
@@ -228,8 +214,12 @@ pat_fnmatch_prefix (const GPtrArray *patterns)
 }
 
 static gboolean
-pat_fnmatch_match (Header pkg, const char *name,
-                   gsize patprefixlen, const GPtrArray *patterns)
+pat_fnmatch_match_nevra (const char *name,
+                         uint64_t    epoch,
+                         const char *version,
+                         const char *release,
+                         const char *arch,
+                         gsize patprefixlen, const GPtrArray *patterns)
 {
   int num = 0;
   g_autofree char *pkg_na    = NULL;
@@ -248,9 +238,16 @@ pat_fnmatch_match (Header pkg, const char *name,
 
       if (!pkg_na)
         {
-          pkg_nevra = pkg_nevra_strdup (pkg);
-          pkg_na    = pkg_na_strdup (pkg);
-          pkg_nvr   = pkg_nvr_strdup (pkg);
+          pkg_nevra = rpmostree_custom_nevra_strdup (name, epoch, version, release, arch,
+                                                     PKG_NEVRA_FLAGS_NAME |
+                                                     PKG_NEVRA_FLAGS_EPOCH_VERSION_RELEASE |
+                                                     PKG_NEVRA_FLAGS_ARCH);
+          pkg_na    = rpmostree_custom_nevra_strdup (name, epoch, version, release, arch,
+                                                     PKG_NEVRA_FLAGS_NAME |
+                                                     PKG_NEVRA_FLAGS_ARCH);
+          pkg_nvr   = rpmostree_custom_nevra_strdup (name, epoch, version, release, arch,
+                                                     PKG_NEVRA_FLAGS_NAME |
+                                                     PKG_NEVRA_FLAGS_VERSION_RELEASE);
         }
 
       if (CASEFNMATCH_EQ (pattern, name) ||
@@ -264,6 +261,21 @@ pat_fnmatch_match (Header pkg, const char *name,
   return FALSE;
 }
 
+static gboolean
+pat_fnmatch_match (Header pkg, const char *name,
+                   gsize patprefixlen, const GPtrArray *patterns)
+{
+  if (!patterns)
+    return TRUE;
+
+  return pat_fnmatch_match_nevra (name,
+                                  headerGetNumber (pkg, RPMTAG_EPOCH),
+                                  headerGetString (pkg, RPMTAG_VERSION),
+                                  headerGetString (pkg, RPMTAG_RELEASE),
+                                  headerGetString (pkg, RPMTAG_ARCH),
+                                  patprefixlen, patterns);
+}
+
 static void
 header_free_p (gpointer data)
 {
@@ -320,6 +332,31 @@ rpmhdrs_new (RpmOstreeRefTs *refts, const GPtrArray *patterns)
   return ret;
 }
 
+/* Like rpmhdrs_new(), but only for the packages named in @names, using the
+ * rpmdb Name index rather than loading every header. */
+static struct RpmHeaders *
+rpmhdrs_new_for_names (RpmOstreeRefTs *refts, const GPtrArray *names)
+{
+  GPtrArray *hs = g_ptr_array_new_with_free_func (header_free_p);
+
+  for (guint i = 0; i < names->len; i++)
+    {
+      const char *name = names->pdata[i];
+      rpmdbMatchIterator iter = rpmtsInitIterator (refts->ts, RPMDBI_NAME, name, 0);
+      Header h1;
+      while ((h1 = rpmdbNextIterator (iter)))
+        g_ptr_array_add (hs, headerLink (h1));
+      rpmdbFreeIterator (iter);
+    }
+
+  g_ptr_array_sort (hs, header_cmp_p);
+
+  struct RpmHeaders *ret = g_malloc0 (sizeof (struct RpmHeaders));
+  ret->refts = rpmostree_refts_ref (refts);
+  ret->hs = hs;
+  return ret;
+}
+
 static void
 rpmhdrs_free (struct RpmHeaders *l1)
 {
@@ -422,6 +459,72 @@ rpmhdrs_list (struct RpmHeaders *l1)
     }
 }
 
+typedef struct {
+  const char *name;
+  guint64 epoch;
+  const char *version;
+  const char *release;
+  const char *arch;
+} PkglistEntry;
+
+/* Same ordering as header_cmp_p() */
+static int
+pkglist_entry_cmp (gconstpointer a,
+                   gconstpointer b)
+{
+  const PkglistEntry *e1 = a;
+  const PkglistEntry *e2 = b;
+  int cmp = strcmp (e1->name, e2->name);
+  if (cmp)
+    return cmp;
+  if (e1->epoch != e2->epoch)
+    return e1->epoch < e2->epoch ? -1 : 1;
+  cmp = rpmvercmp (e1->version, e2->version);
+  if (cmp)
+    return cmp;
+  return rpmvercmp (e1->release, e2->release);
+}
+
+/* Like rpmhdrs_list(), but working from the rpmostree.rpmdb.pkglist commit
+ * metadata, so that we don't need to check out the rpmdb and load every
+ * header just to print NEVRAs. */
+void
+rpmostree_pkglist_list (GVariant        *pkglist,
+                        const GPtrArray *patterns)
+{
+  gsize patprefixlen = pat_fnmatch_prefix (patterns);
+  const guint n = g_variant_n_children (pkglist);
+  g_autoptr(GArray) entries = g_array_sized_new (FALSE, FALSE, sizeof (PkglistEntry), n);
+
+  for (guint i = 0; i < n; i++)
+    {
+      PkglistEntry e;
+      g_variant_get_child (pkglist, i, "(&st&s&s&s)",
+                           &e.name, &e.epoch, &e.version, &e.release, &e.arch);
+
+      if (g_str_equal (e.name, "gpg-pubkey")) continue; /* match rpmhdrs_new() */
+
+      if (!pat_fnmatch_match_nevra (e.name, e.epoch, e.version, e.release, e.arch,
+                                    patprefixlen, patterns))
+        continue;
+
+      g_array_append_val (entries, e);
+    }
+
+  g_array_sort (entries, pkglist_entry_cmp);
+
+  for (guint i = 0; i < entries->len; i++)
+    {
+      PkglistEntry *e = &g_array_index (entries, PkglistEntry, i);
+      g_autofree char *nevra =
+        rpmostree_custom_nevra_strdup (e->name, e->epoch, e->version, e->release, e->arch,
+                                       PKG_NEVRA_FLAGS_NAME |
+                                       PKG_NEVRA_FLAGS_EPOCH_VERSION_RELEASE |
+                                       PKG_NEVRA_FLAGS_ARCH);
+      g_print (" %s\n", nevra);
+    }
+}
+
 char *
 rpmhdrs_rpmdbv (struct RpmHeaders *l1,
                 GCancellable   *cancellable,
@@ -731,6 +834,30 @@ rpmrev_new (OstreeRepo *repo, const char *rev,
   return rpmrev;
 }
 
+/* Like rpmrev_new(), but only loads the headers of the packages named in
+ * @names; useful when we already know which packages we care about. */
+RpmRevisionData *
+rpmrev_new_for_names (OstreeRepo      *repo,
+                      const char      *rev,
+                      const GPtrArray *names,
+                      GCancellable    *cancellable,
+                      GError         **error)
+{
+  g_autofree char *commit = NULL;
+  if (!ostree_repo_resolve_rev (repo, rev, FALSE, &commit, error))
+    return NULL;
+
+  g_autoptr(RpmOstreeRefTs) refts = NULL;
+  if (!rpmostree_get_refts_for_commit (repo, commit, &refts, cancellable, error))
+    return NULL;
+
+  RpmRevisionData *rpmrev = g_malloc0 (sizeof(struct RpmRevisionData));
+  rpmrev->refts = g_steal_pointer (&refts);
+  rpmrev->commit = g_steal_pointer (&commit);
+  rpmrev->rpmdb = rpmhdrs_new_for_names (rpmrev->refts, names);
+  return rpmrev;
+}
+
 struct RpmHeaders *
 rpmrev_get_headers (struct RpmRevisionData *self)
 {
@@ -1114,19 +1241,12 @@ rpmostree_sack_get_sorted_packages (DnfSack *sack)
   return g_steal_pointer (&pkglist);
 }
 
-gboolean
-rpmostree_create_rpmdb_pkglist_variant (int              rootfs_dfd,
-                                        GVariant       **out_variant,
-                                        GCancellable    *cancellable,
-                                        GError         **error)
+/* Build the rpmostree.rpmdb.pkglist variant for @pkglist, which is sorted in
+ * place so that it can efficiently be searched on retrieval */
+GVariant*
+rpmostree_create_pkglist_variant (GPtrArray *pkglist)
 {
-  g_autoptr(RpmOstreeRefSack) refsack =
-    rpmostree_get_refsack_for_root (rootfs_dfd, ".", error);
-  if (!refsack)
-    return FALSE;
-
-  /* we insert it sorted here so it can efficiently be searched on retrieval */
-  g_autoptr(GPtrArray) pkglist = rpmostree_sack_get_sorted_packages (refsack->sack);
+  g_ptr_array_sort (pkglist, (GCompareFunc)pkg_array_compare);
 
   GVariantBuilder pkglist_v_builder;
   g_variant_builder_init (&pkglist_v_builder, (GVariantType*)"a(stsss)");
@@ -1143,6 +1263,21 @@ rpmostree_create_rpmdb_pkglist_variant (int              rootfs_dfd,
                              dnf_package_get_arch (pkg));
     }
 
-  *out_variant = g_variant_ref_sink (g_variant_builder_end (&pkglist_v_builder));
+  return g_variant_ref_sink (g_variant_builder_end (&pkglist_v_builder));
+}
+
+gboolean
+rpmostree_create_rpmdb_pkglist_variant (int              rootfs_dfd,
+                                        GVariant       **out_variant,
+                                        GCancellable    *cancellable,
+                                        GError         **error)
+{
+  g_autoptr(RpmOstreeRefSack) refsack =
+    rpmostree_get_refsack_for_root (rootfs_dfd, ".", error);
+  if (!refsack)
+    return FALSE;
+
+  g_autoptr(GPtrArray) pkglist = rpmostree_sack_get_packages (refsack->sack);
+  *out_variant = rpmostree_create_pkglist_variant (pkglist);
   return TRUE;
 }
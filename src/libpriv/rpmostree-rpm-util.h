@@ -55,6 +55,10 @@ rpmhdrs_diff (struct RpmHeaders *l1,
 void
 rpmhdrs_list (struct RpmHeaders *l1);
 
+void
+rpmostree_pkglist_list (GVariant        *pkglist,
+                        const GPtrArray *patterns);
+
 char *
 rpmhdrs_rpmdbv (struct RpmHeaders *l1,
                 GCancellable *cancellable,
@@ -84,6 +88,13 @@ rpmrev_new (OstreeRepo *repo,
             GCancellable *cancellable,
             GError **error);
 
+struct RpmRevisionData *
+rpmrev_new_for_names (OstreeRepo *repo,
+                      const char *rev,
+                      const GPtrArray *names,
+                      GCancellable *cancellable,
+                      GError **error);
+
 struct RpmHeaders *rpmrev_get_headers (struct RpmRevisionData *self);
 
 const char *rpmrev_get_commit (struct RpmRevisionData *self);
@@ -183,6 +194,9 @@ rpmostree_sack_get_packages (DnfSack *sack);
 GPtrArray*
 rpmostree_sack_get_sorted_packages (DnfSack *sack);
 
+GVariant*
+rpmostree_create_pkglist_variant (GPtrArray *pkglist);
+
 gboolean
 rpmostree_create_rpmdb_pkglist_variant (int              rootfs_dfd,
                                         GVariant       **out_variant,
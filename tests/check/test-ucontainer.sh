@@ -21,7 +21,7 @@ set -euo pipefail
 
 . ${commondir}/libtest.sh
 
-echo "1..2"
+echo "1..3"
 
 rpm-ostree ex container init
 if test -n "${OSTREE_NO_XATTRS:-}"; then
@@ -89,3 +89,37 @@ if rpm-ostree ex container assemble notfound.conf 2>err.txt; then
 fi
 
 echo "ok error conditions"
+
+# Upgrade twice; the second upgrade lands on the root from the initial
+# assemble, which should be updated incrementally
+build_rpm foo version 1.1
+rpm-ostree ex container upgrade foo
+assert_symlink_has_content roots/foo foo.1
+assert_file_has_content roots/foo.1/usr/bin/foo foo-1.1
+build_rpm foo version 1.2
+rpm-ostree ex container upgrade foo > upgrade.txt
+assert_symlink_has_content roots/foo foo.0
+assert_file_has_content upgrade.txt 'Updated .* paths'
+assert_file_has_content roots/foo.0/usr/bin/foo foo-1.2
+echo "ok upgrade"
+
+# Only change the mode of a directory; its contents stay the same, so the
+# incremental update has to notice the dirmeta change by itself
+build_foo_with_dir() {
+    build_rpm foo version $1 \
+              install 'mkdir -p %{buildroot}/usr/share/foo && echo data > %{buildroot}/usr/share/foo/data' \
+              files "%dir %attr($2, -, -) /usr/share/foo
+/usr/share/foo/data"
+}
+build_foo_with_dir 1.3 0755
+rpm-ostree ex container upgrade foo
+assert_symlink_has_content roots/foo foo.1
+build_foo_with_dir 1.4 0755
+rpm-ostree ex container upgrade foo
+assert_symlink_has_content roots/foo foo.0
+build_foo_with_dir 1.5 0700
+rpm-ostree ex container upgrade foo > upgrade.txt
+assert_symlink_has_content roots/foo foo.1
+assert_file_has_content upgrade.txt 'Updated .* paths'
+assert_streq "$(stat -c %a roots/foo.1/usr/share/foo)" 700
+echo "ok upgrade dirmeta"
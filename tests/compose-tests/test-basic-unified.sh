@@ -33,8 +33,17 @@ echo "ok autovar"
 
 # And redo it to trigger relabeling
 origrev=$(ostree --repo=${repobuild} rev-parse ${treeref})
-runcompose  --force-nocache --ex-unified-core
+runcompose  --force-nocache --ex-unified-core |& tee compose.txt
 newrev=$(ostree --repo=${repobuild} rev-parse ${treeref})
 assert_not_streq "${origrev}" "${newrev}"
 
 echo "ok rerun"
+
+# The kernel didn't change, so we should have reused the depmod output
+assert_file_has_content compose.txt 'reusing previous depmod output'
+kver=$(ostree --repo=${repobuild} ls ${treeref} /usr/lib/modules | grep -o '[^/]*$' | tail -1)
+for rev in ${origrev} ${newrev}; do
+    ostree --repo=${repobuild} cat ${rev} /usr/lib/modules/${kver}/modules.dep > modules.dep.${rev}
+done
+cmp modules.dep.${origrev} modules.dep.${newrev}
+echo "ok depmod reuse"
@@ -0,0 +1,15 @@
+#!/bin/bash
+
+set -xeuo pipefail
+
+dn=$(cd $(dirname $0) && pwd)
+. ${dn}/libcomposetest.sh
+
+prepare_compose_test "write-timings"
+runcompose --write-timings-to $(pwd)/timings.json
+for phase in metadata depsolve download commit; do
+    jq -e '.[] | select(.kind == "phase" and .name == "'${phase}'") | .["duration-usec"] >= 0' \
+       < timings.json
+done
+jq -e '.[] | select(.kind == "task" and .name == "Resolving dependencies")' < timings.json
+echo "ok timings"
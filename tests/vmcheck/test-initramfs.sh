@@ -47,6 +47,12 @@ vm_assert_status_jq \
   '.deployments[1].booted' \
   '.deployments[0]["regenerate-initramfs"]' \
   '.deployments[1]["regenerate-initramfs"]|not'
+# Nothing is layered here, so we never depsolved; make sure we still embedded
+# the rpmdb pkglist
+vm_cmd ostree show --print-metadata-key rpmostree.rpmdb.pkglist \
+  $(vm_get_deployment_info 0 checksum) > pkglist.txt
+assert_file_has_content pkglist.txt 'rpm-ostree'
+echo "ok initramfs enable without layered packages"
 
 vm_reboot
 